@@ -0,0 +1,225 @@
+#include "../k3serializer.h"
+#include "../k3serializer_ipc.h"
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Micro benchmarks of the codec primitives. Build with optimizations, e.g.
+// cmake -DCMAKE_BUILD_TYPE=Release, and run k3_bench.
+
+class BenchVarint : public K3SerializerBase
+{
+public:
+	using K3SerializerBase::EncodeVarint32;
+	using K3SerializerBase::EncodeVarint32Wide;
+	using K3SerializerBase::EncodeVarint64;
+	using K3SerializerBase::EncodeVarint64Wide;
+	using K3SerializerBase::kVarintWideSlack;
+	using K3SerializerBase::GetVarint64Ptr;
+	using K3SerializerBase::GetVarint64PtrFallback;
+};
+
+class BenchPrefixVarint : public K3SerializerPrefixVarint
+{
+public:
+	using K3SerializerPrefixVarint::PutPrefixVarint;
+	using K3SerializerPrefixVarint::GetPrefixVarint;
+};
+
+class BenchVarint64 : public K3SerializerVarint64
+{
+public:
+	using K3SerializerVarint64::PutVarint64;
+	using K3SerializerVarint64::GetVarint64;
+};
+
+struct Sample
+{
+	int32_t id;
+	uint32_t level;
+	int64_t gold;
+	uint64_t entity;
+	std::string name;
+	static constexpr inline auto kMetaClassMember = std::make_tuple(&Sample::id, &Sample::level, &Sample::gold, &Sample::entity, &Sample::name);
+	using SuperClass = void;
+};
+template<>
+class K3Serializer<Sample> : public K3SerializerClass<Sample> {};
+
+// the same members with prefix varints
+struct PrefixSample : Sample
+{
+	static constexpr inline auto kMetaClassMember = std::make_tuple(&Sample::id, &Sample::level, &Sample::gold, &Sample::entity, &Sample::name);
+	static constexpr inline uint32_t kMetaClassPolicy = K3ClassPolicy::kPrefixVarint;
+	using SuperClass = void;
+};
+template<>
+class K3Serializer<PrefixSample> : public K3SerializerClass<PrefixSample> {};
+
+template<typename Fn>
+void Report(const char* name, std::size_t items, Fn&& fn)
+{
+	fn();  // warm up
+	const auto start = std::chrono::steady_clock::now();
+	const uint64_t check = fn();
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << name << ": " << elapsed.count() / items << " ns/item (" << check << ")" << std::endl;
+}
+
+// values of uniformly random byte length, the worst case for branchy encoders
+std::vector<uint64_t> RandomMagnitudes(std::size_t n, int maxBits)
+{
+	std::mt19937_64 rng(42);
+	std::vector<uint64_t> values(n);
+	for (auto& v : values)
+	{
+		const int bits = static_cast<int>(rng() % maxBits) + 1;
+		v = rng() >> (64 - bits);
+	}
+	return values;
+}
+
+int main()
+{
+	const std::size_t kValues = 1 << 22;
+	const auto values64 = RandomMagnitudes(kValues, 64);
+	const auto values32 = RandomMagnitudes(kValues, 32);
+	std::vector<char> out(kValues * 10 + BenchVarint::kVarintWideSlack);
+
+	Report("EncodeVarint32", kValues, [&] {
+		char* p = out.data();
+		for (uint64_t v : values32) p = BenchVarint::EncodeVarint32(p, static_cast<uint32_t>(v));
+		return static_cast<uint64_t>(p - out.data());
+	});
+	Report("EncodeVarint32Wide", kValues, [&] {
+		char* p = out.data();
+		for (uint64_t v : values32) p = BenchVarint::EncodeVarint32Wide(p, static_cast<uint32_t>(v));
+		return static_cast<uint64_t>(p - out.data());
+	});
+	Report("EncodeVarint64", kValues, [&] {
+		char* p = out.data();
+		for (uint64_t v : values64) p = BenchVarint::EncodeVarint64(p, v);
+		return static_cast<uint64_t>(p - out.data());
+	});
+	Report("EncodeVarint64Wide", kValues, [&] {
+		char* p = out.data();
+		for (uint64_t v : values64) p = BenchVarint::EncodeVarint64Wide(p, v);
+		return static_cast<uint64_t>(p - out.data());
+	});
+
+	{
+		char* p = out.data();
+		for (uint64_t v : values64) p = BenchVarint::EncodeVarint64Wide(p, v);
+	}
+	const char* const outLimit = out.data() + out.size();
+	Report("GetVarint64PtrFallback", kValues, [&] {
+		const char* p = out.data();
+		uint64_t sum = 0, v;
+		for (std::size_t i = 0; i < kValues; ++i, sum += v) p = BenchVarint::GetVarint64PtrFallback(p, outLimit, &v);
+		return sum;
+	});
+	Report("GetVarint64Ptr", kValues, [&] {
+		const char* p = out.data();
+		uint64_t sum = 0, v;
+		for (std::size_t i = 0; i < kValues; ++i, sum += v) p = BenchVarint::GetVarint64Ptr(p, outLimit, &v);
+		return sum;
+	});
+
+	std::string leb128, prefix;
+	Report("PutVarint64", kValues, [&] {
+		leb128.clear();
+		for (uint64_t v : values64) BenchVarint64::PutVarint64(leb128, v);
+		return static_cast<uint64_t>(leb128.size());
+	});
+	Report("PutVarint64 K3SpanSink", kValues, [&] {
+		K3SpanSink sink(out.data(), out.size());
+		for (uint64_t v : values64) BenchVarint64::PutVarint64(sink, v);
+		return static_cast<uint64_t>(sink.size());
+	});
+	Report("PutPrefixVarint", kValues, [&] {
+		prefix.clear();
+		for (uint64_t v : values64) BenchPrefixVarint::PutPrefixVarint(prefix, v);
+		return static_cast<uint64_t>(prefix.size());
+	});
+	Report("GetVarint64", kValues, [&] {
+		std::string_view src = leb128;
+		uint64_t sum = 0, v;
+		while (BenchVarint64::GetVarint64(src, &v)) sum += v;
+		return sum;
+	});
+	Report("GetPrefixVarint", kValues, [&] {
+		std::string_view src = prefix;
+		uint64_t sum = 0, v;
+		while (BenchPrefixVarint::GetPrefixVarint(src, &v)) sum += v;
+		return sum;
+	});
+
+	std::vector<Sample> samples(1 << 16);
+	for (std::size_t i = 0; i < samples.size(); ++i)
+	{
+		samples[i] = { static_cast<int32_t>(values32[i]), static_cast<uint32_t>(values32[i + 1]),
+			static_cast<int64_t>(values64[i]), values64[i + 1], "sample" };
+	}
+	std::string encoded;
+	Report("PutValue(Sample)", samples.size(), [&] {
+		encoded.clear();
+		for (const auto& sample : samples) K3Serializer<Sample>::PutValue(encoded, sample);
+		return static_cast<uint64_t>(encoded.size());
+	});
+	Report("GetValue(Sample)", samples.size(), [&] {
+		std::string_view src = encoded;
+		Sample sample;
+		uint64_t sum = 0;
+		while (!src.empty() && K3Serializer<Sample>::GetValue(src, sample)) sum += sample.entity;
+		return sum;
+	});
+	std::vector<PrefixSample> prefixSamples(samples.size());
+	for (std::size_t i = 0; i < samples.size(); ++i)
+	{
+		static_cast<Sample&>(prefixSamples[i]) = samples[i];
+	}
+	Report("PutValue(PrefixSample)", prefixSamples.size(), [&] {
+		encoded.clear();
+		for (const auto& sample : prefixSamples) K3Serializer<PrefixSample>::PutValue(encoded, sample);
+		return static_cast<uint64_t>(encoded.size());
+	});
+	Report("GetValue(PrefixSample)", prefixSamples.size(), [&] {
+		std::string_view src = encoded;
+		PrefixSample sample;
+		uint64_t sum = 0;
+		while (!src.empty() && K3Serializer<PrefixSample>::GetValue(src, sample)) sum += sample.entity;
+		return sum;
+	});
+
+	// round trips through a forked echo process; an id of -1 ends it
+	K3IpcChannel request, reply;
+	if (request.Create(1 << 20) && reply.Create(1 << 20))
+	{
+		const pid_t child = fork();
+		if (child == 0)
+		{
+			Sample sample;
+			while (request.Receive(sample) && sample.id != -1) reply.Send(sample);
+			_exit(0);
+		}
+		const std::size_t kRoundTrips = 200000;
+		Report("K3IpcChannel round trip(Sample)", kRoundTrips, [&] {
+			Sample sample;
+			uint64_t sum = 0;
+			for (std::size_t i = 0; i < kRoundTrips; ++i)
+			{
+				request.Send(samples[i % samples.size()]);
+				reply.Receive(sample);
+				sum += sample.entity;
+			}
+			return sum;
+		});
+		Sample stop{};
+		stop.id = -1;
+		request.Send(stop);
+		waitpid(child, nullptr, 0);
+	}
+	return 0;
+}
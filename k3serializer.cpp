@@ -1,26 +1,194 @@
 #include "k3serializer.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#if defined(__GNUC__)
+#include <cxxabi.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define K3_HAS_RDTSC 1
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__BMI2__)
+#include <immintrin.h>
+#define K3_VARINT_RUNTIME_BMI2 1
+#endif
 
-int K3SerializerBase::VarintLength(uint64_t v)
+namespace
 {
-	int len = 1;
-	while (v >= 128) {
-		v >>= 7;
-		len++;
+	int BitLength(uint64_t v)
+	{
+#if defined(__GNUC__)
+		return v == 0 ? 0 : 64 - __builtin_clzll(v);
+#else
+		int len = 0;
+		while (v != 0) {
+			v >>= 1;
+			len++;
+		}
+		return len;
+#endif
+	}
+
+#if defined(__GNUC__)
+	constexpr uint64_t kVarintPayloadBits = 0x7f7f7f7f7f7f7f7fULL;
+	constexpr uint64_t kVarintContinuationBits = 0x8080808080808080ULL;
+
+	// Length of the varint starting the little-endian word, 0 when all its 8 bytes carry a
+	// continuation bit. *mask selects its bytes.
+	inline int VarintWordLength(uint64_t word, uint64_t* mask)
+	{
+		const uint64_t stops = ~word & kVarintContinuationBits;
+		if (stops == 0) {
+			return 0;
+		}
+		*mask = stops ^ (stops - 1);
+		return (__builtin_ctzll(stops) >> 3) + 1;
+	}
+	// pext(x, kVarintPayloadBits) with shifts: 7-bit groups to 14, 28 then 56 bits
+	inline uint64_t CompactVarintGroups(uint64_t x)
+	{
+#if defined(__BMI2__)
+		return _pext_u64(x, kVarintPayloadBits);
+#else
+		x &= kVarintPayloadBits;
+		x = ((x & 0x7f007f007f007f00ULL) >> 1) | (x & 0x007f007f007f007fULL);
+		x = ((x & 0x3fff00003fff0000ULL) >> 2) | (x & 0x00003fff00003fffULL);
+		x = ((x & 0x0fffffff00000000ULL) >> 4) | (x & 0x000000000fffffffULL);
+		return x;
+#endif
+	}
+	inline const char* DecodeVarint64Word(const char* p, uint64_t word, uint64_t* v)
+	{
+		uint64_t mask;
+		const int len = VarintWordLength(word, &mask);
+		if (len == 0) {
+			return nullptr;
+		}
+		*v = CompactVarintGroups(word & mask);
+		return p + len;
+	}
+#if defined(K3_VARINT_RUNTIME_BMI2)
+	__attribute__((target("bmi2"))) const char* DecodeVarint64WordBmi2(const char* p, uint64_t word, uint64_t* v)
+	{
+		uint64_t mask;
+		const int len = VarintWordLength(word, &mask);
+		if (len == 0) {
+			return nullptr;
+		}
+		*v = _pext_u64(word & mask, kVarintPayloadBits);
+		return p + len;
+	}
+	bool HasBmi2()
+	{
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("bmi2");
 	}
-	return len;
+	const bool kHasBmi2 = HasBmi2();
+#endif
+#endif
 }
-void K3SerializerBase::EncodeFixed32(char* buf, uint32_t v)
+
+namespace
 {
-	if constexpr (port::kLittleEndian) {
-		memcpy(buf, &v, sizeof(v));
+	struct InstrumentRecord
+	{
+		const std::type_info* type;
+		int member;
+		const std::type_info* memberType;
+		K3InstrumentCounters counters;
+	};
+	struct InstrumentRegistry
+	{
+		std::mutex mutex;
+		std::vector<std::unique_ptr<InstrumentRecord>> records;
+	};
+	InstrumentRegistry& Registry()
+	{
+		static InstrumentRegistry registry;
+		return registry;
 	}
-	else {
-		buf[0] = v & 0xff;
-		buf[1] = (v >> 8) & 0xff;
-		buf[2] = (v >> 16) & 0xff;
-		buf[3] = (v >> 24) & 0xff;
+}
+
+std::string K3TypeName(const std::type_info& type)
+{
+#if defined(__GNUC__)
+	int status = 0;
+	char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+	if (status == 0 && demangled != nullptr) {
+		std::string name(demangled);
+		free(demangled);
+		return name;
+	}
+#endif
+	return type.name();
+}
+
+K3InstrumentCounters* K3Instrument::Register(const std::type_info& type, int member, const std::type_info& memberType)
+{
+	auto record = std::make_unique<InstrumentRecord>();
+	record->type = &type;
+	record->member = member;
+	record->memberType = &memberType;
+	InstrumentRegistry& registry = Registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	registry.records.push_back(std::move(record));
+	return &registry.records.back()->counters;
+}
+std::vector<K3InstrumentEntry> K3Instrument::Snapshot()
+{
+	std::vector<K3InstrumentEntry> entries;
+	InstrumentRegistry& registry = Registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for (const auto& record : registry.records) {
+		const K3InstrumentCounters& c = record->counters;
+		entries.push_back({ K3TypeName(*record->type), record->member,
+			record->member < 0 ? std::string() : K3TypeName(*record->memberType),
+			c.putCalls.load(std::memory_order_relaxed), c.putBytes.load(std::memory_order_relaxed), c.putCycles.load(std::memory_order_relaxed),
+			c.getCalls.load(std::memory_order_relaxed), c.getBytes.load(std::memory_order_relaxed), c.getCycles.load(std::memory_order_relaxed) });
+	}
+	std::sort(entries.begin(), entries.end(), [](const K3InstrumentEntry& lhs, const K3InstrumentEntry& rhs) {
+		return lhs.type != rhs.type ? lhs.type < rhs.type : lhs.member < rhs.member;
+	});
+	return entries;
+}
+void K3Instrument::Reset()
+{
+	InstrumentRegistry& registry = Registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for (const auto& record : registry.records) {
+		K3InstrumentCounters& c = record->counters;
+		for (auto* counter : { &c.putCalls, &c.putBytes, &c.putCycles, &c.getCalls, &c.getBytes, &c.getCycles }) {
+			counter->store(0, std::memory_order_relaxed);
+		}
 	}
 }
+uint64_t K3Instrument::Now()
+{
+#if defined(K3_HAS_RDTSC)
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+int K3SerializerBase::VarintLength(uint64_t v)
+{
+	// ceil(bits / 7) without a division or a loop
+	return (BitLength(v | 1) * 9 + 64) / 64;
+}
+void K3SerializerBase::EncodeFixed32(char* buf, uint32_t v)
+{
+	v = port::LittleEndian32(v);
+	memcpy(buf, &v, sizeof(v));
+}
 char* K3SerializerBase::EncodeVarint32(char* dst, uint32_t v) {
 	// Operate on characters as unsigneds
 	unsigned char* ptr = reinterpret_cast<unsigned char*>(dst);
@@ -92,21 +260,31 @@ char* K3SerializerBase::EncodeVarint64(char* dst, uint64_t v) {
 }
 void K3SerializerBase::EncodeFixed64(char* buf, uint64_t v)
 {
-	if (port::kLittleEndian) {
-		memcpy(buf, &v, sizeof(v));
-	}
-	else {
-		buf[0] = v & 0xff;
-		buf[1] = (v >> 8) & 0xff;
-		buf[2] = (v >> 16) & 0xff;
-		buf[3] = (v >> 24) & 0xff;
-		buf[4] = (v >> 32) & 0xff;
-		buf[5] = (v >> 40) & 0xff;
-		buf[6] = (v >> 48) & 0xff;
-		buf[7] = (v >> 56) & 0xff;
-	}
+	v = port::LittleEndian64(v);
+	memcpy(buf, &v, sizeof(v));
 }
 const char* K3SerializerBase::GetVarint64Ptr(const char* p, const char* limit, uint64_t* v)
+{
+#if defined(__GNUC__)
+	// one load decodes varints of up to 8 bytes: the first byte without continuation bit ends
+	// it and its payload bits are gathered with pext (or shifts); longer ones and short
+	// tails take the byte loop
+	if (limit - p >= 8) {
+		const uint64_t word = DecodeFixed64(p);
+		const char* q;
+#if defined(K3_VARINT_RUNTIME_BMI2)
+		q = kHasBmi2 ? DecodeVarint64WordBmi2(p, word, v) : DecodeVarint64Word(p, word, v);
+#else
+		q = DecodeVarint64Word(p, word, v);
+#endif
+		if (q != nullptr) {
+			return q;
+		}
+	}
+#endif
+	return GetVarint64PtrFallback(p, limit, v);
+}
+const char* K3SerializerBase::GetVarint64PtrFallback(const char* p, const char* limit, uint64_t* v)
 {
 	uint64_t result = 0;
 	for (uint32_t shift = 0; shift <= 63 && p < limit; shift += 7) {
@@ -125,6 +303,80 @@ const char* K3SerializerBase::GetVarint64Ptr(const char* p, const char* limit, u
 	return nullptr;
 }
 
+bool K3SerializerBase::SkipVarint(std::string_view& input, std::size_t maxLength)
+{
+	const std::size_t limit = std::min(input.size(), maxLength);
+	for (std::size_t i = 0; i < limit; ++i) {
+		if ((static_cast<unsigned char>(input[i]) & 128) == 0) {
+			input.remove_prefix(i + 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+namespace
+{
+	// Bit i is set where bits i .. i + Length - 1 of x all are.
+	template<std::size_t Length>
+	uint32_t RunStarts(uint32_t x)
+	{
+		std::size_t len = 1;
+		for (; len * 2 <= Length; len *= 2) {
+			x &= x >> len;
+		}
+		return len < Length ? x & (x >> (Length - len)) : x;
+	}
+
+	// Past `count` varints of at most MaxLength bytes each, nullptr if they are not all there.
+	template<std::size_t MaxLength>
+	const char* SkipVarintRun(const char* p, const char* limit, std::size_t count)
+	{
+		static_assert(MaxLength <= 16, "a run is checked across two chunks");
+		// continuation bytes in a row so far
+		std::size_t run = 0;
+#if defined(__SSE2__)
+		// every byte with a clear high bit ends a varint; a chunk holds at most 16 of them
+		uint32_t previous = 0;
+		while (count >= 16 && limit - p >= 16) {
+			const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			const uint32_t continuations = static_cast<uint32_t>(_mm_movemask_epi8(bytes));
+			// MaxLength continuation bytes in a row ending in this chunk, counting the previous one
+			if ((RunStarts<MaxLength>(continuations << 16 | previous) >> (17 - MaxLength)) != 0) {
+				return nullptr;
+			}
+			count -= __builtin_popcount(~continuations & 0xFFFF);
+			previous = continuations;
+			p += 16;
+		}
+		run = __builtin_clz(~(previous << 16));
+#endif
+		for (; count > 0 && p < limit; ++p) {
+			if ((static_cast<unsigned char>(*p) & 128) == 0) {
+				--count;
+				run = 0;
+			}
+			else if (++run >= MaxLength) {
+				return nullptr;
+			}
+		}
+		return count == 0 ? p : nullptr;
+	}
+}
+
+bool K3SerializerBase::SkipVarints(std::string_view& input, std::size_t count, std::size_t maxLength)
+{
+	const char* limit = input.data() + input.size();
+	const char* p = maxLength == kMaxVarint32Length
+		? SkipVarintRun<kMaxVarint32Length>(input.data(), limit, count)
+		: SkipVarintRun<kMaxVarint64Length>(input.data(), limit, count);
+	if (p == nullptr) {
+		return false;
+	}
+	input = std::string_view(p, limit - p);
+	return true;
+}
+
 bool K3SerializerByte::GetByte(std::string_view& input, uint8_t* v)
 {
 	if (input.size() < sizeof(uint8_t))
@@ -136,12 +388,6 @@ bool K3SerializerByte::GetByte(std::string_view& input, uint8_t* v)
 	return true;
 }
 
-void K3SerializerVarint32::PutVarint32(std::string& dst, uint32_t v)
-{
-	char buf[5];
-	char* ptr = EncodeVarint32(buf, v);
-	dst.append(buf, ptr - buf);
-}
 bool K3SerializerVarint32::GetVarint32(std::string_view& input, uint32_t* v)
 {
 	const char* p = input.data();
@@ -156,12 +402,6 @@ bool K3SerializerVarint32::GetVarint32(std::string_view& input, uint32_t* v)
 	}
 }
 
-void K3SerializerFixed32::PutFixed32(std::string& dst, uint32_t v)
-{
-	char buf[sizeof(v)];
-	EncodeFixed32(buf, v);
-	dst.append(buf, sizeof(buf));
-}
 bool K3SerializerFixed32::GetFixed32(std::string_view& input, uint32_t* v)
 {
 	if (input.size() < sizeof(uint32_t))
@@ -172,12 +412,6 @@ bool K3SerializerFixed32::GetFixed32(std::string_view& input, uint32_t* v)
 	return true;
 }
 
-void K3SerializerVarint64::PutVarint64(std::string& dst, uint64_t v)
-{
-	char buf[10];
-	char* ptr = EncodeVarint64(buf, v);
-	dst.append(buf, ptr - buf);
-}
 bool K3SerializerVarint64::GetVarint64(std::string_view& input, uint64_t* v)
 {
 	const char* p = input.data();
@@ -192,12 +426,6 @@ bool K3SerializerVarint64::GetVarint64(std::string_view& input, uint64_t* v)
 	}
 }
 
-void K3SerializerFixed64::PutFixed64(std::string& dst, uint64_t v)
-{
-	char buf[sizeof(v)];
-	EncodeFixed64(buf, v);
-	dst.append(buf, sizeof(buf));
-}
 bool K3SerializerFixed64::GetFixed64(std::string_view& input, uint64_t* v)
 {
 	if (input.size() < sizeof(uint64_t))
@@ -206,4 +434,129 @@ bool K3SerializerFixed64::GetFixed64(std::string_view& input, uint64_t* v)
 	}
 	*v = DecodeFixed64(input.data());
 	return true;
-}
\ No newline at end of file
+}
+
+char* K3SerializerPacked::EncodePackedBlock(char* dst, const uint64_t* deltas, std::size_t n)
+{
+	// choose the bit width that minimizes packed bits + exception cost
+	std::size_t histogram[65] = {};
+	for (std::size_t i = 0; i < n; ++i) {
+		histogram[BitLength(deltas[i])]++;
+	}
+	int width = 64;
+	std::size_t best = static_cast<std::size_t>(-1);
+	for (int b = 0; b <= 64; ++b) {
+		std::size_t cost = (n * b + 7) / 8;
+		for (int len = b + 1; len <= 64; ++len) {
+			cost += histogram[len] * (1 + (len - b + 6) / 7);
+		}
+		if (cost < best) {
+			best = cost;
+			width = b;
+		}
+	}
+	const uint64_t mask = width == 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+	uint32_t exceptions = 0;
+	for (std::size_t i = 0; i < n; ++i) {
+		exceptions += (deltas[i] & ~mask) != 0;
+	}
+	*(dst++) = static_cast<char>(width);
+	dst = EncodeVarint32(dst, exceptions);
+
+	// pack the whole block into a word buffer first, OR-ing each value into the word its first
+	// bit lands in and its spill into the next, then copy the words out in one go
+	uint64_t words[kPackedBlockSize + 1] = {};
+	for (std::size_t i = 0; i < n; ++i) {
+		const std::size_t bit = i * width;
+		const uint64_t v = deltas[i] & mask;
+		const unsigned offset = bit % 64;
+		words[bit / 64] |= v << offset;
+		if (offset + width > 64) {
+			words[bit / 64 + 1] |= v >> (64 - offset);
+		}
+	}
+	const std::size_t packedLength = (n * width + 7) / 8;
+	for (std::size_t i = 0; i * 8 < packedLength; ++i) {
+		char buf[8];
+		EncodeFixed64(buf, words[i]);
+		memcpy(dst + i * 8, buf, std::min<std::size_t>(8, packedLength - i * 8));
+	}
+	dst += packedLength;
+
+	for (std::size_t i = 0; i < n && exceptions != 0; ++i) {
+		if ((deltas[i] & ~mask) != 0) {
+			*(dst++) = static_cast<char>(i);
+			dst = EncodeVarint64(dst, deltas[i] >> width);
+		}
+	}
+	return dst;
+}
+const char* K3SerializerPacked::DecodePackedBlock(const char* p, const char* limit, uint64_t* deltas, std::size_t n)
+{
+	if (p >= limit) {
+		return nullptr;
+	}
+	const unsigned width = static_cast<unsigned char>(*(p++));
+	uint32_t exceptions;
+	if (width > 64 || (p = GetVarint32Ptr(p, limit, &exceptions)) == nullptr || exceptions > n) {
+		return nullptr;
+	}
+	const std::size_t packedLength = (n * width + 7) / 8;
+	if (static_cast<std::size_t>(limit - p) < packedLength) {
+		return nullptr;
+	}
+	uint64_t words[kPackedBlockSize + 1] = {};
+	for (std::size_t i = 0; i * 8 < packedLength; ++i) {
+		char buf[8] = {};
+		memcpy(buf, p + i * 8, std::min<std::size_t>(8, packedLength - i * 8));
+		words[i] = DecodeFixed64(buf);
+	}
+	p += packedLength;
+
+	const uint64_t mask = width == 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+	for (std::size_t i = 0; i < n; ++i) {
+		const std::size_t bit = i * width;
+		const unsigned offset = bit % 64;
+		uint64_t v = words[bit / 64] >> offset;
+		if (offset + width > 64) {
+			v |= words[bit / 64 + 1] << (64 - offset);
+		}
+		deltas[i] = v & mask;
+	}
+
+	for (uint32_t i = 0; i < exceptions; ++i) {
+		uint64_t high;
+		if (p >= limit) {
+			return nullptr;
+		}
+		const std::size_t pos = static_cast<unsigned char>(*(p++));
+		if (pos >= n || (p = GetVarint64Ptr(p, limit, &high)) == nullptr || width == 64) {
+			return nullptr;
+		}
+		deltas[pos] |= high << width;
+	}
+	return p;
+}
+const char* K3SerializerPacked::SkipPackedBlock(const char* p, const char* limit, std::size_t n)
+{
+	if (p >= limit) {
+		return nullptr;
+	}
+	const unsigned width = static_cast<unsigned char>(*(p++));
+	uint32_t exceptions;
+	if (width > 64 || (p = GetVarint32Ptr(p, limit, &exceptions)) == nullptr || exceptions > n) {
+		return nullptr;
+	}
+	const std::size_t packedLength = (n * width + 7) / 8;
+	if (static_cast<std::size_t>(limit - p) < packedLength) {
+		return nullptr;
+	}
+	p += packedLength;
+	for (uint32_t i = 0; i < exceptions; ++i) {
+		uint64_t high;
+		if (p >= limit || (p = GetVarint64Ptr(p + 1, limit, &high)) == nullptr) {
+			return nullptr;
+		}
+	}
+	return p;
+}
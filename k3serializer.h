@@ -28,24 +28,207 @@ SOFTWARE.
 */
 
 #pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
 #include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <memory_resource>
 #include <type_traits>
+#include <typeinfo>
 #include <string.h>
 #include <string>
 #include <string_view>
+#include <optional>
 #include <tuple>
+#include <utility>
+#include <variant>
 #include <vector>
 #include <unordered_map>
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+#if __cplusplus > 201703L && defined(__has_include)
+#if __has_include(<bit>)
+#include <bit>
+#endif
+#endif
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
 
 namespace port
 {
-	static constexpr const bool kLittleEndian = true;
+#if defined(__cpp_lib_endian)
+	static_assert(std::endian::native == std::endian::little || std::endian::native == std::endian::big, "mixed-endian hosts are not supported");
+	static constexpr const bool kLittleEndian = std::endian::native == std::endian::little;
+#elif defined(__BYTE_ORDER__)
+	static constexpr const bool kLittleEndian = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+#else
+	static constexpr const bool kLittleEndian = true;  // MSVC only targets little-endian hosts
+#endif
+#if defined(__FLOAT_WORD_ORDER__) && defined(__BYTE_ORDER__)
+	static_assert(__FLOAT_WORD_ORDER__ == __BYTE_ORDER__, "doubles with swapped words (old ARM FPA) are not supported");
+#endif
+
+	inline uint16_t ByteSwap16(uint16_t v)
+	{
+#if defined(__GNUC__)
+		return __builtin_bswap16(v);
+#elif defined(_MSC_VER)
+		return _byteswap_ushort(v);
+#else
+		return static_cast<uint16_t>((v >> 8) | (v << 8));
+#endif
+	}
+	inline uint32_t ByteSwap32(uint32_t v)
+	{
+#if defined(__GNUC__)
+		return __builtin_bswap32(v);
+#elif defined(_MSC_VER)
+		return _byteswap_ulong(v);
+#else
+		return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+#endif
+	}
+	inline uint64_t ByteSwap64(uint64_t v)
+	{
+#if defined(__GNUC__)
+		return __builtin_bswap64(v);
+#elif defined(_MSC_VER)
+		return _byteswap_uint64(v);
+#else
+		return (static_cast<uint64_t>(ByteSwap32(static_cast<uint32_t>(v))) << 32) | ByteSwap32(static_cast<uint32_t>(v >> 32));
+#endif
+	}
+	// host order <-> wire (little-endian) order, the same operation both ways
+	inline uint32_t LittleEndian32(uint32_t v)
+	{
+		if constexpr (kLittleEndian)
+		{
+			return v;
+		}
+		else
+		{
+			return ByteSwap32(v);
+		}
+	}
+	inline uint64_t LittleEndian64(uint64_t v)
+	{
+		if constexpr (kLittleEndian)
+		{
+			return v;
+		}
+		else
+		{
+			return ByteSwap64(v);
+		}
+	}
+	template<typename To, typename From>
+	inline To BitCast(const From& from)
+	{
+		static_assert(sizeof(To) == sizeof(From), "BitCast needs types of the same size");
+#if defined(__cpp_lib_bit_cast)
+		return std::bit_cast<To>(from);
+#else
+		To to;
+		memcpy(&to, &from, sizeof(to));
+		return to;
+#endif
+	}
+	// Copies count fixed-width values of sizeof(T) bytes between host and wire order: a
+	// plain memcpy on little-endian hosts, a byte swap per value (vectorized by compilers)
+	// otherwise.
+	template<typename T>
+	inline void CopyLittleEndian(void* dst, const void* src, std::size_t count)
+	{
+		static_assert(sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8, "unsupported width");
+		if constexpr (kLittleEndian)
+		{
+			memcpy(dst, src, count * sizeof(T));
+		}
+		else
+		{
+			using Word = std::conditional_t<sizeof(T) == 2, uint16_t, std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>;
+			char* out = static_cast<char*>(dst);
+			const char* in = static_cast<const char*>(src);
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				Word w;
+				memcpy(&w, in + i * sizeof(w), sizeof(w));
+				if constexpr (sizeof(w) == 2)
+				{
+					w = ByteSwap16(w);
+				}
+				else if constexpr (sizeof(w) == 4)
+				{
+					w = ByteSwap32(w);
+				}
+				else
+				{
+					w = ByteSwap64(w);
+				}
+				memcpy(out + i * sizeof(w), &w, sizeof(w));
+			}
+		}
+	}
 }
 
+template<typename Dst, typename = void>
+struct K3HasAppendPayload : std::false_type {};
+template<typename Dst>
+struct K3HasAppendPayload<Dst, std::void_t<decltype(std::declval<Dst&>().AppendPayload(std::declval<const char*>(), std::size_t()))>> : std::true_type {};
+
+template<typename Dst, typename = void>
+struct K3HasClaim : std::false_type {};
+template<typename Dst>
+struct K3HasClaim<Dst, std::void_t<decltype(std::declval<Dst&>().Claim(std::size_t())), decltype(std::declval<Dst&>().Advance(std::size_t()))>> : std::true_type {};
+
+// PutValue writes to any Dst providing append(const char*, size_t) and push_back(char),
+// std::string being the default one. A Dst may also provide Claim(n), returning n writable
+// bytes at its end or nullptr, and Advance(n), keeping n of them: varints are then encoded
+// straight into it instead of through a local buffer.
 class K3SerializerBase
 {
 public:
+	static constexpr std::size_t kMaxVarint32Length = 5;
+	static constexpr std::size_t kMaxVarint64Length = 10;
+
 	static int VarintLength(uint64_t v);
+
+	// Appends bytes owned by the object being serialized. Sinks providing AppendPayload()
+	// may reference them in place instead of copying (see K3IovecSink).
+	template<typename Dst>
+	static void PutPayload(Dst& dst, const char* p, std::size_t n)
+	{
+		if constexpr (K3HasAppendPayload<Dst>::value)
+		{
+			dst.AppendPayload(p, n);
+		}
+		else
+		{
+			dst.append(p, n);
+		}
+	}
+	static bool SkipBytes(std::string_view& input, std::size_t n)
+	{
+		if (input.size() < n)
+		{
+			return false;
+		}
+		input.remove_prefix(n);
+		return true;
+	}
+	// Skips a varint of at most maxLength bytes, the longest one its decoder accepts.
+	static bool SkipVarint(std::string_view& input, std::size_t maxLength = kMaxVarint64Length);
+	static bool SkipVarint32(std::string_view& input) { return SkipVarint(input, kMaxVarint32Length); }
+	// Skips `count` consecutive varints of at most maxLength bytes each (kMaxVarint32Length
+	// or kMaxVarint64Length), scanning 16 continuation bits at a time with SSE2.
+	static bool SkipVarints(std::string_view& input, std::size_t count, std::size_t maxLength = kMaxVarint64Length);
 protected:
 	static void EncodeFixed32(char* buf, uint32_t v);
 	static char* EncodeVarint32(char* dst, uint32_t v);
@@ -54,39 +237,75 @@ protected:
 	static char* EncodeVarint64(char* dst, uint64_t v);
 	static void EncodeFixed64(char* buf, uint64_t v);
 	static const char* GetVarint64Ptr(const char* p, const char* limit, uint64_t* v);
+	static const char* GetVarint64PtrFallback(const char* p, const char* limit, uint64_t* v);
+
+	// Branch-free encoders for outputs with kVarintWideSlack writable bytes: the length comes
+	// from the bit length, the 7-bit groups are spread over the bytes with one pdep (shifts
+	// and masks without BMI2) and written with fixed-size, overlapping stores. pdep is only
+	// used when the build targets BMI2 (-mbmi2, -march=haswell or later): the encoders are
+	// inlined into every PutValue, and a runtime-dispatched pdep would cost an out-of-line
+	// call per varint, more than the shifts it replaces.
+	static constexpr std::size_t kVarintWideSlack = 16;
+	static char* EncodeVarint32Wide(char* dst, uint32_t v)
+	{
+		const std::size_t len = WideVarintLength(v);
+		const uint64_t bytes = port::LittleEndian64(SpreadVarintGroups(v) | kVarintContinuation[len]);
+		memcpy(dst, &bytes, sizeof(bytes));
+		return dst + len;
+	}
+	static char* EncodeVarint64Wide(char* dst, uint64_t v)
+	{
+		const std::size_t len = WideVarintLength(v);
+		const uint64_t bytes = port::LittleEndian64(SpreadVarintGroups(v) | kVarintContinuation[len]);
+		memcpy(dst, &bytes, sizeof(bytes));
+		// bits 56..63 land in bytes 8 and 9, written whether the value reaches them or not
+		dst[8] = static_cast<char>(((v >> 56) & 0x7f) | ((v >> 63) << 7));
+		dst[9] = static_cast<char>(v >> 63);
+		return dst + len;
+	}
 	static inline uint32_t DecodeFixed32(const char* ptr) {
-		if constexpr (port::kLittleEndian) {
-			// Load the raw bytes
-			uint32_t result;
-			memcpy(&result, ptr, sizeof(result));  // gcc optimizes this to a plain load
-			return result;
-		}
-		else {
-			return ((static_cast<uint32_t>(static_cast<unsigned char>(ptr[0])))
-				| (static_cast<uint32_t>(static_cast<unsigned char>(ptr[1])) << 8)
-				| (static_cast<uint32_t>(static_cast<unsigned char>(ptr[2])) << 16)
-				| (static_cast<uint32_t>(static_cast<unsigned char>(ptr[3])) << 24));
-		}
+		uint32_t result;
+		memcpy(&result, ptr, sizeof(result));  // gcc optimizes this to a plain load
+		return port::LittleEndian32(result);
 	}
 	static inline uint64_t DecodeFixed64(const char* ptr) {
-		if (port::kLittleEndian) {
-			// Load the raw bytes
-			uint64_t result;
-			memcpy(&result, ptr, sizeof(result));  // gcc optimizes this to a plain load
-			return result;
-		}
-		else {
-			uint64_t lo = DecodeFixed32(ptr);
-			uint64_t hi = DecodeFixed32(ptr + 4);
-			return (hi << 32) | lo;
-		}
+		uint64_t result;
+		memcpy(&result, ptr, sizeof(result));
+		return port::LittleEndian64(result);
+	}
+private:
+	// 0x80 in every byte of a varint of the given length but its last (the first 8 bytes only)
+	static constexpr uint64_t kVarintContinuation[11] = {
+		0, 0, 0x80, 0x8080, 0x808080, 0x80808080, 0x8080808080, 0x808080808080,
+		0x80808080808080, 0x8080808080808080, 0x8080808080808080 };
+
+	static std::size_t WideVarintLength(uint64_t v)
+	{
+#if defined(__GNUC__)
+		const std::size_t bits = 64 - __builtin_clzll(v | 1);
+		return (bits * 9 + 64) / 64;
+#else
+		return VarintLength(v);
+#endif
+	}
+	// the low 56 bits of v as eight 7-bit groups, one per byte
+	static uint64_t SpreadVarintGroups(uint64_t v)
+	{
+#if defined(__BMI2__)
+		return _pdep_u64(v, 0x7f7f7f7f7f7f7f7fULL);
+#else
+		return (v & 0x7fULL) | ((v << 1) & 0x7f00ULL) | ((v << 2) & 0x7f0000ULL) | ((v << 3) & 0x7f000000ULL)
+			| ((v << 4) & 0x7f00000000ULL) | ((v << 5) & 0x7f0000000000ULL) | ((v << 6) & 0x7f000000000000ULL)
+			| ((v << 7) & 0x7f00000000000000ULL);
+#endif
 	}
 };
 
 class K3SerializerByte : public K3SerializerBase
 {
 protected:
-	static void PutByte(std::string& dst, uint8_t v) { dst += *reinterpret_cast<char*>(&v); }
+	template<typename Dst>
+	static void PutByte(Dst& dst, uint8_t v) { dst.push_back(static_cast<char>(v)); }
 	static bool GetByte(std::string_view& input, uint8_t* v);
 };
 
@@ -94,36 +313,219 @@ protected:
 class K3SerializerVarint32 : public K3SerializerBase
 {
 protected:
-	static void PutVarint32(std::string& dst, uint32_t v);
+	template<typename Dst>
+	static void PutVarint32(Dst& dst, uint32_t v)
+	{
+		if constexpr (K3HasClaim<Dst>::value)
+		{
+			if (char* out = dst.Claim(kVarintWideSlack))
+			{
+				dst.Advance(EncodeVarint32Wide(out, v) - out);
+				return;
+			}
+		}
+		char buf[kVarintWideSlack];
+		char* ptr = EncodeVarint32Wide(buf, v);
+		dst.append(buf, ptr - buf);
+	}
 	static bool GetVarint32(std::string_view& input, uint32_t* v);
 };
 
 class K3SerializerFixed32 : public K3SerializerBase
 {
 protected:
-	static void PutFixed32(std::string& dst, uint32_t v);
+	template<typename Dst>
+	static void PutFixed32(Dst& dst, uint32_t v)
+	{
+		char buf[sizeof(v)];
+		EncodeFixed32(buf, v);
+		dst.append(buf, sizeof(buf));
+	}
 	static bool GetFixed32(std::string_view& input, uint32_t* v);
 };
 
 class K3SerializerVarint64 : public K3SerializerBase
 {
 protected:
-	static void PutVarint64(std::string& dst, uint64_t v);
+	template<typename Dst>
+	static void PutVarint64(Dst& dst, uint64_t v)
+	{
+		if constexpr (K3HasClaim<Dst>::value)
+		{
+			if (char* out = dst.Claim(kVarintWideSlack))
+			{
+				dst.Advance(EncodeVarint64Wide(out, v) - out);
+				return;
+			}
+		}
+		char buf[kVarintWideSlack];
+		char* ptr = EncodeVarint64Wide(buf, v);
+		dst.append(buf, ptr - buf);
+	}
 	static bool GetVarint64(std::string_view& input, uint64_t* v);
 };
 
 class K3SerializerFixed64 : public K3SerializerBase
 {
 protected:
-	static void PutFixed64(std::string& dst, uint64_t v);
+	template<typename Dst>
+	static void PutFixed64(Dst& dst, uint64_t v)
+	{
+		char buf[sizeof(v)];
+		EncodeFixed64(buf, v);
+		dst.append(buf, sizeof(buf));
+	}
 	static bool GetFixed64(std::string_view& input, uint64_t* v);
 };
 
+// Frame-of-reference coding for blocks of up to kPackedBlockSize zigzag deltas: a header
+// (bit width, exception count), the deltas bit-packed at that width, then the high bits
+// of the few deltas that did not fit (PFor exceptions) as (position, varint) pairs.
+class K3SerializerPacked : public K3SerializerVarint32
+{
+protected:
+	static constexpr std::size_t kPackedBlockSize = 128;
+	static constexpr std::size_t kMaxPackedBlockLength = 1 + 5 + kPackedBlockSize * 8 + kPackedBlockSize * (1 + 10);
+	static char* EncodePackedBlock(char* dst, const uint64_t* deltas, std::size_t n);
+	static const char* DecodePackedBlock(const char* p, const char* limit, uint64_t* deltas, std::size_t n);
+	static const char* SkipPackedBlock(const char* p, const char* limit, std::size_t n);
+	static uint64_t ZigZagEncode(uint64_t v) { return (v << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(v) >> 63); }
+	static uint64_t ZigZagDecode(uint64_t v) { return (v >> 1) ^ (~(v & 1) + 1); }
+};
+
+constexpr std::array<uint8_t, 256> K3MakePrefixVarintLengths()
+{
+	std::array<uint8_t, 256> lengths{};
+	for (std::size_t b = 0; b < lengths.size(); ++b)
+	{
+		uint8_t len = 1;
+		while (len < 9 && ((b >> (len - 1)) & 1) == 0)
+		{
+			++len;
+		}
+		lengths[b] = len;
+	}
+	return lengths;
+}
+
+// Prefix varint: the trailing zero bits of the first byte, plus one, give the total length
+// (1 to 9 bytes), so a decode is a table lookup, one unaligned load and a mask instead of a
+// scan for continuation bits. Lengths 1-8 hold 7 value bits per byte above the tag bits,
+// length 9 (first byte 0) is followed by the value as a fixed64. The tag sits in the low
+// bits rather than the high ones as in UTF-8 so that a little-endian load needs only a shift.
+// Not wire compatible with LEB128: opt in per type (K3SerializerPrefix) or per class
+// (K3ClassPolicy::kPrefixVarint).
+class K3SerializerPrefixVarint : public K3SerializerBase
+{
+public:
+	static constexpr std::size_t kMaxPrefixVarintLength = 9;
+
+	static std::size_t PrefixVarintLength(uint64_t v)
+	{
+		return std::min<std::size_t>(VarintLength(v), kMaxPrefixVarintLength);
+	}
+	static bool SkipPrefixVarint(std::string_view& input)
+	{
+		return !input.empty() && SkipBytes(input, kPrefixVarintLength[static_cast<uint8_t>(input.front())]);
+	}
+protected:
+	template<typename Dst>
+	static void PutPrefixVarint(Dst& dst, uint64_t v)
+	{
+		char buf[kMaxPrefixVarintLength];
+		const std::size_t len = PrefixVarintLength(v);
+		if (len < kMaxPrefixVarintLength)
+		{
+			EncodeFixed64(buf, (v << len) | (uint64_t(1) << (len - 1)));
+		}
+		else
+		{
+			buf[0] = 0;
+			EncodeFixed64(buf + 1, v);
+		}
+		dst.append(buf, len);
+	}
+	static bool GetPrefixVarint(std::string_view& input, uint64_t* v)
+	{
+		if (input.empty())
+		{
+			return false;
+		}
+		const std::size_t len = kPrefixVarintLength[static_cast<uint8_t>(input.front())];
+		if (input.size() < len)
+		{
+			return false;
+		}
+		if (len == kMaxPrefixVarintLength)
+		{
+			*v = DecodeFixed64(input.data() + 1);
+		}
+		else
+		{
+			uint64_t word;
+			if (input.size() >= sizeof(word))
+			{
+				word = DecodeFixed64(input.data());
+			}
+			else
+			{
+				char buf[sizeof(word)] = {};
+				memcpy(buf, input.data(), len);
+				word = DecodeFixed64(buf);
+			}
+			*v = (word >> len) & ((uint64_t(1) << (7 * len)) - 1);
+		}
+		input.remove_prefix(len);
+		return true;
+	}
+private:
+	static constexpr std::array<uint8_t, 256> kPrefixVarintLength = K3MakePrefixVarintLengths();
+};
+
+template<typename T, typename = void>
+struct K3UnsignedOf { using type = std::make_unsigned_t<T>; };
+template<typename T>
+struct K3UnsignedOf<T, std::enable_if_t<std::is_enum_v<T>>> { using type = std::make_unsigned_t<std::underlying_type_t<T>>; };
+
+// An integer or enum type in the prefix-varint format, e.g.
+//   template<> class K3Serializer<EntityId> : public K3SerializerPrefix<EntityId> {};
+// Signed values are written as the unsigned integer of the same width.
+template<typename T>
+class K3SerializerPrefix : public K3SerializerPrefixVarint
+{
+	using Unsigned = typename K3UnsignedOf<T>::type;
+public:
+	template<typename Dst>
+	static void PutValue(Dst& dst, const T& v)
+	{
+		PutPrefixVarint(dst, static_cast<Unsigned>(v));
+	}
+	static bool GetValue(std::string_view& src, T& v)
+	{
+		uint64_t u;
+		if (!GetPrefixVarint(src, &u) || u > std::numeric_limits<Unsigned>::max())
+		{
+			return false;
+		}
+		v = static_cast<T>(static_cast<Unsigned>(u));
+		return true;
+	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return SkipPrefixVarint(src);
+	}
+	static std::size_t ByteSize(const T& v)
+	{
+		return PrefixVarintLength(static_cast<Unsigned>(v));
+	}
+};
+
 template<typename T, typename=std::enable_if_t<std::is_enum_v<T>>>
 class K3SerializerEnum : public K3SerializerVarint32
 {
 public:
-	static void PutValue(std::string& dst, T v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, T v)
 	{
 		PutVarint32(dst, static_cast<uint32_t>(v));
 	}
@@ -137,17 +539,256 @@ public:
 		}
 		return false;
 	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return SkipVarint32(src);
+	}
+	static std::size_t ByteSize(T v)
+	{
+		return VarintLength(static_cast<uint32_t>(v));
+	}
+};
+
+// While a K3CanonicalScope is alive on the current thread, containers without a defined
+// iteration order (std::unordered_map) are written in sorted key order, so equal objects
+// always produce identical bytes (usable as hash / cache keys). Keys without operator< are
+// ordered by their encoded bytes instead.
+class K3CanonicalScope
+{
+public:
+	explicit K3CanonicalScope(bool enable = true) : prev_(enabled_) { enabled_ = enable; }
+	~K3CanonicalScope() { enabled_ = prev_; }
+	K3CanonicalScope(const K3CanonicalScope&) = delete;
+	K3CanonicalScope& operator=(const K3CanonicalScope&) = delete;
+
+	static bool IsEnabled() { return enabled_; }
+private:
+	bool prev_;
+	static inline thread_local bool enabled_ = false;
+};
+
+template<typename T, typename = void>
+struct K3IsLessComparable : std::false_type {};
+template<typename T>
+struct K3IsLessComparable<T, std::void_t<decltype(std::declval<const T&>() < std::declval<const T&>())>> : std::true_type {};
+
+template<typename T, typename A>
+T K3MakeUsingAllocator(const A& alloc)
+{
+	if constexpr (std::uses_allocator_v<T, A>)
+	{
+		if constexpr (std::is_constructible_v<T, std::allocator_arg_t, const A&>)
+		{
+			return T(std::allocator_arg, alloc);
+		}
+		else
+		{
+			return T(alloc);
+		}
+	}
+	else
+	{
+		return T();
+	}
+}
+
+// Instrumentation: build with K3SERIALIZER_INSTRUMENT defined to count calls, bytes and
+// cycles (rdtsc where available, nanoseconds otherwise) of every reflected class and of
+// each of its members, then read them with K3Instrument::Snapshot(). Cycles are inclusive
+// of nested values; bytes written are only known for sinks with size(). Bool members packed
+// into one byte are counted together under the first of them. Without the macro the hooks
+// expand to nothing.
+struct K3InstrumentCounters
+{
+	std::atomic<uint64_t> putCalls{ 0 };
+	std::atomic<uint64_t> putBytes{ 0 };
+	std::atomic<uint64_t> putCycles{ 0 };
+	std::atomic<uint64_t> getCalls{ 0 };
+	std::atomic<uint64_t> getBytes{ 0 };
+	std::atomic<uint64_t> getCycles{ 0 };
+};
+
+struct K3InstrumentEntry
+{
+	std::string type;        // the reflected class
+	int member;              // index in its kMetaClassMember, -1 for the class as a value
+	std::string memberType;
+	uint64_t putCalls;
+	uint64_t putBytes;
+	uint64_t putCycles;
+	uint64_t getCalls;
+	uint64_t getBytes;
+	uint64_t getCycles;
+};
+
+// Readable (demangled where possible) name of a type.
+std::string K3TypeName(const std::type_info& type);
+
+class K3Instrument
+{
+public:
+	static std::vector<K3InstrumentEntry> Snapshot();
+	static void Reset();
+	static K3InstrumentCounters* Register(const std::type_info& type, int member, const std::type_info& memberType);
+	static uint64_t Now();
+
+	template<typename T, int Member = -1, typename M = void>
+	static K3InstrumentCounters& Of()
+	{
+		static K3InstrumentCounters* const counters = Register(typeid(T), Member, typeid(M));
+		return *counters;
+	}
+};
+
+template<typename Dst, typename = void>
+struct K3HasSize : std::false_type {};
+template<typename Dst>
+struct K3HasSize<Dst, std::void_t<decltype(std::declval<const Dst&>().size())>> : std::true_type {};
+
+template<typename Dst>
+class K3InstrumentPutScope
+{
+public:
+	K3InstrumentPutScope(K3InstrumentCounters& counters, const Dst& dst)
+		: counters_(counters), dst_(dst), size_(SizeOf(dst)), start_(K3Instrument::Now()) {}
+	~K3InstrumentPutScope()
+	{
+		counters_.putCycles.fetch_add(K3Instrument::Now() - start_, std::memory_order_relaxed);
+		counters_.putBytes.fetch_add(SizeOf(dst_) - size_, std::memory_order_relaxed);
+		counters_.putCalls.fetch_add(1, std::memory_order_relaxed);
+	}
+private:
+	static std::size_t SizeOf(const Dst& dst)
+	{
+		if constexpr (K3HasSize<Dst>::value)
+		{
+			return dst.size();
+		}
+		else
+		{
+			return 0;
+		}
+	}
+	K3InstrumentCounters& counters_;
+	const Dst& dst_;
+	std::size_t size_;
+	uint64_t start_;
+};
+
+class K3InstrumentGetScope
+{
+public:
+	K3InstrumentGetScope(K3InstrumentCounters& counters, const std::string_view& src)
+		: counters_(counters), src_(src), size_(src.size()), start_(K3Instrument::Now()) {}
+	~K3InstrumentGetScope()
+	{
+		counters_.getCycles.fetch_add(K3Instrument::Now() - start_, std::memory_order_relaxed);
+		counters_.getBytes.fetch_add(size_ - src_.size(), std::memory_order_relaxed);
+		counters_.getCalls.fetch_add(1, std::memory_order_relaxed);
+	}
+private:
+	K3InstrumentCounters& counters_;
+	const std::string_view& src_;
+	std::size_t size_;
+	uint64_t start_;
 };
 
+#if defined(K3SERIALIZER_INSTRUMENT)
+#define K3_INSTRUMENT_PUT(counters, dst) K3InstrumentPutScope<std::decay_t<decltype(dst)>> k3InstrumentScope_(counters, dst)
+#define K3_INSTRUMENT_GET(counters, src) K3InstrumentGetScope k3InstrumentScope_(counters, src)
+#else
+#define K3_INSTRUMENT_PUT(counters, dst)
+#define K3_INSTRUMENT_GET(counters, src)
+#endif
+
 //class K3Serializer;
 
 template<typename T>
 class K3Serializer;
 
+template<typename T, typename = void>
+struct K3HasSkipValue : std::false_type {};
+template<typename T>
+struct K3HasSkipValue<T, std::void_t<decltype(K3Serializer<T>::SkipValue(std::declval<std::string_view&>()))>> : std::true_type {};
+
+template<typename T, typename = void>
+struct K3HasByteSize : std::false_type {};
+template<typename T>
+struct K3HasByteSize<T, std::void_t<decltype(K3Serializer<T>::ByteSize(std::declval<const T&>()))>> : std::true_type {};
+
+// Sink that only counts what would be written.
+class K3SizeCounter
+{
+public:
+	K3SizeCounter() : size_(0) {}
+	void append(const char*, std::size_t n) { size_ += n; }
+	void push_back(char) { ++size_; }
+	std::size_t size() const { return size_; }
+private:
+	std::size_t size_;
+};
+
+// Sink writing into memory sized beforehand (e.g. with K3ByteSize), without bound checks.
+// capacity, the bytes writable at dst if known, lets varints be encoded in place up to the
+// last few bytes.
+class K3SpanSink
+{
+public:
+	explicit K3SpanSink(char* dst, std::size_t capacity = 0) : begin_(dst), cur_(dst), capacity_(capacity) {}
+	void append(const char* p, std::size_t n)
+	{
+		memcpy(cur_, p, n);
+		cur_ += n;
+	}
+	void push_back(char c) { *(cur_++) = c; }
+	char* Claim(std::size_t n) { return size() + n <= capacity_ ? cur_ : nullptr; }
+	void Advance(std::size_t n) { cur_ += n; }
+	std::size_t size() const { return cur_ - begin_; }
+	char* data() const { return cur_; }
+private:
+	char* begin_;
+	char* cur_;
+	std::size_t capacity_;
+};
+
+// Exact encoded size of v. Serializers lacking ByteSize() are measured by encoding into
+// a K3SizeCounter.
+template<typename T>
+std::size_t K3ByteSize(const T& v)
+{
+	if constexpr (K3HasByteSize<T>::value)
+	{
+		return K3Serializer<T>::ByteSize(v);
+	}
+	else
+	{
+		K3SizeCounter counter;
+		K3Serializer<T>::PutValue(counter, v);
+		return counter.size();
+	}
+}
+
+// Moves src past an encoded T without building it. Serializers lacking SkipValue()
+// (e.g. user-defined ones) decode into a temporary instead.
+template<typename T>
+bool K3SkipValue(std::string_view& src)
+{
+	if constexpr (K3HasSkipValue<T>::value)
+	{
+		return K3Serializer<T>::SkipValue(src);
+	}
+	else
+	{
+		T ignored{};
+		return K3Serializer<T>::GetValue(src, ignored);
+	}
+}
+
 template<>
 class K3Serializer<int64_t> : public K3SerializerVarint64 {
 public:
-	static void PutValue(std::string& dst, int64_t v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, int64_t v)
 	{
 		PutVarint64(dst, v);
 	}
@@ -155,11 +796,20 @@ public:
 	{
 		return GetVarint64(src, reinterpret_cast<uint64_t*>(&v));
 	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return SkipVarint(src);
+	}
+	static std::size_t ByteSize(int64_t v)
+	{
+		return VarintLength(static_cast<uint64_t>(v));
+	}
 };
 template<>
 class K3Serializer<uint64_t> : public K3SerializerVarint64 {
 public:
-	static void PutValue(std::string& dst, uint64_t v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, uint64_t v)
 	{
 		PutVarint64(dst, v);
 	}
@@ -167,12 +817,21 @@ public:
 	{
 		return GetVarint64(src, &v);
 	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return SkipVarint(src);
+	}
+	static std::size_t ByteSize(uint64_t v)
+	{
+		return VarintLength(static_cast<uint64_t>(v));
+	}
 };
 
 template<>
 class K3Serializer<int> : public K3SerializerVarint32 {
 public:
-	static void PutValue(std::string& dst, int v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, int v)
 	{
 		PutVarint32(dst, v);
 	}
@@ -180,11 +839,20 @@ public:
 	{
 		return GetVarint32(src, reinterpret_cast<uint32_t*>(&v));
 	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return SkipVarint32(src);
+	}
+	static std::size_t ByteSize(int v)
+	{
+		return VarintLength(static_cast<uint32_t>(v));
+	}
 };
 template<>
 class K3Serializer<uint32_t> : public K3SerializerVarint32 {
 public:
-	static void PutValue(std::string& dst, uint32_t v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, uint32_t v)
 	{
 		PutVarint32(dst, v);
 	}
@@ -192,11 +860,20 @@ public:
 	{
 		return GetVarint32(src, &v);
 	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return SkipVarint32(src);
+	}
+	static std::size_t ByteSize(uint32_t v)
+	{
+		return VarintLength(static_cast<uint32_t>(v));
+	}
 };
 template<>
 class K3Serializer<int16_t> : public K3SerializerVarint32 {
 public:
-	static void PutValue(std::string& dst, int16_t v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, int16_t v)
 	{
 		PutVarint32(dst, static_cast<uint32_t>(v));
 	}
@@ -210,11 +887,20 @@ public:
 		}
 		return false;
 	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return SkipVarint32(src);
+	}
+	static std::size_t ByteSize(int16_t v)
+	{
+		return VarintLength(static_cast<uint32_t>(v));
+	}
 };
 template<>
 class K3Serializer<uint16_t> : public K3SerializerVarint32 {
 public:
-	static void PutValue(std::string& dst, uint16_t v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, uint16_t v)
 	{
 		PutVarint32(dst, static_cast<uint32_t>(v));
 	}
@@ -228,11 +914,20 @@ public:
 		}
 		return false;
 	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return SkipVarint32(src);
+	}
+	static std::size_t ByteSize(uint16_t v)
+	{
+		return VarintLength(static_cast<uint32_t>(v));
+	}
 };
 template<>
 class K3Serializer<char> : public K3SerializerByte {
 public:
-	static void PutValue(std::string& dst, char v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, char v)
 	{
 		PutByte(dst, v);
 	}
@@ -240,11 +935,20 @@ public:
 	{
 		return GetByte(src, reinterpret_cast<uint8_t*>(&v));
 	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return SkipBytes(src, 1);
+	}
+	static std::size_t ByteSize(char)
+	{
+		return 1;
+	}
 };
 template<>
 class K3Serializer<int8_t> : public K3SerializerByte {
 public:
-	static void PutValue(std::string& dst, int8_t v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, int8_t v)
 	{
 		PutByte(dst, v);
 	}
@@ -252,11 +956,20 @@ public:
 	{
 		return GetByte(src, reinterpret_cast<uint8_t*>(&v));
 	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return SkipBytes(src, 1);
+	}
+	static std::size_t ByteSize(int8_t)
+	{
+		return 1;
+	}
 };
 template<>
 class K3Serializer<uint8_t> : public K3SerializerByte {
 public:
-	static void PutValue(std::string& dst, uint8_t v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, uint8_t v)
 	{
 		PutByte(dst, v);
 	}
@@ -264,63 +977,115 @@ public:
 	{
 		return GetByte(src, &v);
 	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return SkipBytes(src, 1);
+	}
+	static std::size_t ByteSize(uint8_t)
+	{
+		return 1;
+	}
+};
+
+template<>
+class K3Serializer<bool> : public K3SerializerByte {
+public:
+	template<typename Dst>
+	static void PutValue(Dst& dst, bool v)
+	{
+		PutByte(dst, v ? 1 : 0);
+	}
+	static bool GetValue(std::string_view& src, bool& v)
+	{
+		uint8_t u;
+		if (GetByte(src, &u))
+		{
+			v = u != 0;
+			return true;
+		}
+		return false;
+	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return SkipBytes(src, 1);
+	}
+	static std::size_t ByteSize(bool)
+	{
+		return 1;
+	}
 };
 
 template<>
 class K3Serializer<float> : public K3SerializerFixed32 {
 public:
-	static void PutValue(std::string& dst, float v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, float v)
 	{
-		union { float f; uint32_t u; };
-		f = v;
-		PutFixed32(dst, u);
+		PutFixed32(dst, port::BitCast<uint32_t>(v));
 	}
 	static bool GetValue(std::string_view& src, float& v)
 	{
-		union { float f; uint32_t u; };
+		uint32_t u;
 		if(GetFixed32(src, &u))
 		{
-			v = f;
+			v = port::BitCast<float>(u);
 			src.remove_prefix(sizeof(float));
 			return true;
 		}
 		return false;
 	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return SkipBytes(src, sizeof(float));
+	}
+	static std::size_t ByteSize(float)
+	{
+		return sizeof(float);
+	}
 };
 
 
 template<>
 class K3Serializer<double> : public K3SerializerFixed64 {
 public:
-	static void PutValue(std::string& dst, double v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, double v)
 	{
-		union { double d; uint64_t l; };
-		d = v;
-		PutFixed64(dst, l);
+		PutFixed64(dst, port::BitCast<uint64_t>(v));
 	}
 	static bool GetValue(std::string_view& src, double& v)
 	{
-		union { double d; uint64_t l; };
+		uint64_t l;
 		if (GetFixed64(src, &l))
 		{
-			v = d;
+			v = port::BitCast<double>(l);
 			src.remove_prefix(sizeof(double));
 			return true;
 		}
 		return false;
 	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return SkipBytes(src, sizeof(double));
+	}
+	static std::size_t ByteSize(double)
+	{
+		return sizeof(double);
+	}
 };
 
-template<>
-class K3Serializer<std::string> : public K3SerializerVarint32
+template<typename A>
+class K3Serializer<std::basic_string<char, std::char_traits<char>, A>> : public K3SerializerVarint32
 {
+	using String = std::basic_string<char, std::char_traits<char>, A>;
 public:
-	static void PutValue(std::string& dst, const std::string& v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, const String& v)
 	{
 		PutVarint32(dst, static_cast<uint32_t>(v.size()));
-		dst.append(v.data(), v.size());
+		PutPayload(dst, v.data(), v.size());
 	}
-	static bool GetValue(std::string_view& src, std::string& v)
+	static bool GetValue(std::string_view& src, String& v)
 	{
 		uint32_t len;
 		if (GetVarint32(src, &len) && src.size() >= len) {
@@ -332,27 +1097,195 @@ public:
 			return false;
 		}
 	}
+	static bool SkipValue(std::string_view& src)
+	{
+		uint32_t len;
+		return GetVarint32(src, &len) && SkipBytes(src, len);
+	}
+	static std::size_t ByteSize(const String& v)
+	{
+		return VarintLength(v.size()) + v.size();
+	}
+};
+
+// Read-only bytes that either own a copy or reference a slice of a shared, refcounted buffer.
+// Wire compatible with std::string. Decoded under a K3SharedBufferScope (see K3SharedDecoder)
+// a slice of at least the scope's minimum size references the decoded buffer instead of
+// copying it, and keeps the whole buffer alive as long as it exists.
+class K3SharedSlice
+{
+public:
+	K3SharedSlice() = default;
+	explicit K3SharedSlice(std::string str)
+		: owner_(std::make_shared<const std::string>(std::move(str))), view_(*owner_) {}
+	// view must lie within *owner
+	K3SharedSlice(std::shared_ptr<const std::string> owner, std::string_view view)
+		: owner_(std::move(owner)), view_(view) {}
+
+	const char* data() const { return view_.data(); }
+	std::size_t size() const { return view_.size(); }
+	bool empty() const { return view_.empty(); }
+	std::string_view view() const { return view_; }
+	operator std::string_view() const { return view_; }
+	std::string str() const { return std::string(view_); }
+	const std::shared_ptr<const std::string>& owner() const { return owner_; }
+
+	bool operator==(const K3SharedSlice& rhs) const { return view_ == rhs.view_; }
+	bool operator!=(const K3SharedSlice& rhs) const { return view_ != rhs.view_; }
+private:
+	std::shared_ptr<const std::string> owner_;
+	std::string_view view_;
+};
+
+// Makes K3SharedSlice decoding on this thread reference `owner` for input lying within it.
+class K3SharedBufferScope
+{
+public:
+	static constexpr std::size_t kDefaultMinShared = 256;
+
+	explicit K3SharedBufferScope(std::shared_ptr<const std::string> owner, std::size_t minShared = kDefaultMinShared)
+		: owner_(std::move(owner)), minShared_(minShared), prev_(current_) { current_ = this; }
+	~K3SharedBufferScope() { current_ = prev_; }
+	K3SharedBufferScope(const K3SharedBufferScope&) = delete;
+	K3SharedBufferScope& operator=(const K3SharedBufferScope&) = delete;
+
+	static const K3SharedBufferScope* Current() { return current_; }
+	// The slice sharing `v`, if `v` is large enough and lies within the owner.
+	bool Share(std::string_view v, K3SharedSlice* slice) const
+	{
+		const std::less<const char*> before;
+		if (v.size() < minShared_ || before(v.data(), owner_->data()) || before(owner_->data() + owner_->size(), v.data() + v.size()))
+		{
+			return false;
+		}
+		*slice = K3SharedSlice(owner_, v);
+		return true;
+	}
+private:
+	std::shared_ptr<const std::string> owner_;
+	std::size_t minShared_;
+	const K3SharedBufferScope* prev_;
+	static inline thread_local const K3SharedBufferScope* current_ = nullptr;
+};
+
+template<>
+class K3Serializer<K3SharedSlice> : public K3SerializerVarint32
+{
+public:
+	template<typename Dst>
+	static void PutValue(Dst& dst, const K3SharedSlice& v)
+	{
+		PutVarint32(dst, static_cast<uint32_t>(v.size()));
+		PutPayload(dst, v.data(), v.size());
+	}
+	static bool GetValue(std::string_view& src, K3SharedSlice& v)
+	{
+		uint32_t len;
+		if (!GetVarint32(src, &len) || src.size() < len)
+		{
+			return false;
+		}
+		const std::string_view bytes = src.substr(0, len);
+		const K3SharedBufferScope* scope = K3SharedBufferScope::Current();
+		if (scope == nullptr || !scope->Share(bytes, &v))
+		{
+			v = K3SharedSlice(std::string(bytes));
+		}
+		src.remove_prefix(len);
+		return true;
+	}
+	static bool SkipValue(std::string_view& src)
+	{
+		uint32_t len;
+		return GetVarint32(src, &len) && SkipBytes(src, len);
+	}
+	static std::size_t ByteSize(const K3SharedSlice& v)
+	{
+		return VarintLength(v.size()) + v.size();
+	}
+};
+
+// Decodes a T from a buffer handed over by the caller: the buffer is moved, not copied, into
+// a shared owner, and the K3SharedSlice members of T reference it. std::string members are
+// still copies.
+template<typename T>
+class K3SharedDecoder
+{
+public:
+	static bool GetValue(std::string&& buffer, T& obj, std::size_t minShared = K3SharedBufferScope::kDefaultMinShared)
+	{
+		return GetValue(std::make_shared<const std::string>(std::move(buffer)), obj, minShared);
+	}
+	static bool GetValue(const std::shared_ptr<const std::string>& buffer, T& obj, std::size_t minShared = K3SharedBufferScope::kDefaultMinShared)
+	{
+		K3SharedBufferScope scope(buffer, minShared);
+		std::string_view src = *buffer;
+		return K3Serializer<T>::GetValue(src, obj);
+	}
 };
 
+template<typename T, typename = void>
+struct K3IsVarint : std::bool_constant<std::is_same_v<T, int64_t> || std::is_same_v<T, uint64_t> || std::is_same_v<T, int>
+	|| std::is_same_v<T, uint32_t> || std::is_same_v<T, int16_t> || std::is_same_v<T, uint16_t>> {};
 template<typename T>
-class K3Serializer<std::vector<T>> : public K3SerializerVarint32
+struct K3IsVarint<T, std::enable_if_t<std::is_enum_v<T>>> : std::is_base_of<K3SerializerEnum<T>, K3Serializer<T>> {};
+
+// Element types whose wire form is their little-endian bytes: vectors of them are copied
+// (and byte swapped on big-endian hosts) in bulk.
+template<typename T>
+struct K3IsFixedWidth : std::bool_constant<std::is_same_v<T, float> || std::is_same_v<T, double>> {};
+
+template<typename T, typename A>
+class K3Serializer<std::vector<T, A>> : public K3SerializerVarint32
 {
+	static constexpr std::size_t kSwapBlock = 256;
 public:
-	static void PutValue(std::string& dst, const std::vector<T>& v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, const std::vector<T, A>& v)
 	{
 		PutVarint32(dst, static_cast<uint32_t>(v.size()));
+		if constexpr (K3IsFixedWidth<T>::value)
+		{
+			if constexpr (port::kLittleEndian)
+			{
+				PutPayload(dst, reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+			}
+			else
+			{
+				char buf[kSwapBlock * sizeof(T)];
+				for (std::size_t i = 0; i < v.size(); i += kSwapBlock)
+				{
+					const std::size_t n = std::min(kSwapBlock, v.size() - i);
+					port::CopyLittleEndian<T>(buf, v.data() + i, n);
+					dst.append(buf, n * sizeof(T));
+				}
+			}
+			return;
+		}
 		for (const auto& e : v)
 		{
 			K3Serializer<T>::PutValue(dst, e);
 		}
 	}
-	static bool GetValue(std::string_view& src, std::vector<T>& v)
+	static bool GetValue(std::string_view& src, std::vector<T, A>& v)
 	{
 		uint32_t vsize;
 		if (!GetVarint32(src, &vsize))
 		{
 			return false;
 		}
+		if constexpr (K3IsFixedWidth<T>::value)
+		{
+			if (src.size() / sizeof(T) < vsize)
+			{
+				return false;
+			}
+			const std::size_t base = v.size();
+			v.resize(base + vsize);
+			port::CopyLittleEndian<T>(v.data() + base, src.data(), vsize);
+			src.remove_prefix(vsize * sizeof(T));
+			return true;
+		}
 		for (uint32_t i = 0; i < vsize; ++i)
 		{
 			if (!K3Serializer<T>::GetValue(src, v.emplace_back()))
@@ -362,23 +1295,293 @@ public:
 		}
 		return true;
 	}
+	static bool SkipValue(std::string_view& src)
+	{
+		uint32_t vsize;
+		if (!GetVarint32(src, &vsize))
+		{
+			return false;
+		}
+		if constexpr (K3IsVarint<T>::value)
+		{
+			constexpr bool kWide = std::is_same_v<T, int64_t> || std::is_same_v<T, uint64_t>;
+			return SkipVarints(src, vsize, kWide ? kMaxVarint64Length : kMaxVarint32Length);
+		}
+		if constexpr (K3IsFixedWidth<T>::value)
+		{
+			return src.size() / sizeof(T) >= vsize && SkipBytes(src, vsize * sizeof(T));
+		}
+		for (uint32_t i = 0; i < vsize; ++i)
+		{
+			if (!K3SkipValue<T>(src))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	static std::size_t ByteSize(const std::vector<T, A>& v)
+	{
+		std::size_t size = VarintLength(v.size());
+		if constexpr (K3IsFixedWidth<T>::value)
+		{
+			return size + v.size() * sizeof(T);
+		}
+		for (const auto& e : v)
+		{
+			size += K3ByteSize<T>(e);
+		}
+		return size;
+	}
+};
+
+// Opt-in delta + bit-packed encoding for integer vectors (sorted ids, timestamps...).
+// Use it as the member type instead of std::vector<T>.
+template<typename T>
+class K3PackedVector : public std::vector<T>
+{
+public:
+	using std::vector<T>::vector;
+};
+
+template<typename T>
+class K3Serializer<K3PackedVector<T>> : public K3SerializerPacked
+{
+	static_assert(std::is_integral_v<T> && !std::is_same_v<T, bool>, "K3PackedVector needs an integer type");
+public:
+	template<typename Dst>
+	static void PutValue(Dst& dst, const K3PackedVector<T>& v)
+	{
+		PutVarint32(dst, static_cast<uint32_t>(v.size()));
+		uint64_t deltas[kPackedBlockSize];
+		char buf[kMaxPackedBlockLength];
+		uint64_t prev = 0;
+		for (std::size_t i = 0; i < v.size(); i += kPackedBlockSize)
+		{
+			const std::size_t n = std::min(kPackedBlockSize, v.size() - i);
+			for (std::size_t j = 0; j < n; ++j)
+			{
+				const uint64_t cur = static_cast<uint64_t>(v[i + j]);
+				deltas[j] = ZigZagEncode(cur - prev);
+				prev = cur;
+			}
+			char* ptr = EncodePackedBlock(buf, deltas, n);
+			dst.append(buf, ptr - buf);
+		}
+	}
+	static bool GetValue(std::string_view& src, K3PackedVector<T>& v)
+	{
+		uint32_t vsize;
+		// a block holds at most kPackedBlockSize values in no less than 2 bytes
+		if (!GetVarint32(src, &vsize) || vsize / (kPackedBlockSize / 2) > src.size())
+		{
+			return false;
+		}
+		v.resize(vsize);
+		uint64_t deltas[kPackedBlockSize];
+		uint64_t prev = 0;
+		const char* p = src.data();
+		const char* limit = p + src.size();
+		for (std::size_t i = 0; i < vsize; i += kPackedBlockSize)
+		{
+			const std::size_t n = std::min<std::size_t>(kPackedBlockSize, vsize - i);
+			p = DecodePackedBlock(p, limit, deltas, n);
+			if (p == nullptr)
+			{
+				return false;
+			}
+			for (std::size_t j = 0; j < n; ++j)
+			{
+				prev += ZigZagDecode(deltas[j]);
+				v[i + j] = static_cast<T>(prev);
+			}
+		}
+		src = std::string_view(p, limit - p);
+		return true;
+	}
+	static bool SkipValue(std::string_view& src)
+	{
+		uint32_t vsize;
+		if (!GetVarint32(src, &vsize))
+		{
+			return false;
+		}
+		const char* p = src.data();
+		const char* limit = p + src.size();
+		for (std::size_t i = 0; i < vsize && p != nullptr; i += kPackedBlockSize)
+		{
+			p = SkipPackedBlock(p, limit, std::min<std::size_t>(kPackedBlockSize, vsize - i));
+		}
+		if (p == nullptr)
+		{
+			return false;
+		}
+		src = std::string_view(p, limit - p);
+		return true;
+	}
+};
+
+// 8 flags per byte, least significant bit first
+template<typename A>
+class K3Serializer<std::vector<bool, A>> : public K3SerializerVarint32
+{
+public:
+	template<typename Dst>
+	static void PutValue(Dst& dst, const std::vector<bool, A>& v)
+	{
+		PutVarint32(dst, static_cast<uint32_t>(v.size()));
+		char buf[64];
+		std::size_t i = 0;
+		while (i < v.size())
+		{
+			std::size_t n = 0;
+			for (; n < sizeof(buf) && i < v.size(); ++n)
+			{
+				uint8_t byte = 0;
+				for (unsigned bit = 0; bit < 8 && i < v.size(); ++bit, ++i)
+				{
+					byte |= static_cast<uint8_t>(v[i]) << bit;
+				}
+				buf[n] = static_cast<char>(byte);
+			}
+			dst.append(buf, n);
+		}
+	}
+	static bool GetValue(std::string_view& src, std::vector<bool, A>& v)
+	{
+		uint32_t vsize;
+		if (!GetVarint32(src, &vsize) || src.size() < (static_cast<std::size_t>(vsize) + 7) / 8)
+		{
+			return false;
+		}
+		const std::size_t base = v.size();
+		v.resize(base + vsize);
+		for (uint32_t i = 0; i < vsize; ++i)
+		{
+			v[base + i] = ((static_cast<uint8_t>(src[i / 8]) >> (i % 8)) & 1) != 0;
+		}
+		src.remove_prefix((static_cast<std::size_t>(vsize) + 7) / 8);
+		return true;
+	}
+	static bool SkipValue(std::string_view& src)
+	{
+		uint32_t vsize;
+		return GetVarint32(src, &vsize) && SkipBytes(src, (static_cast<std::size_t>(vsize) + 7) / 8);
+	}
+	static std::size_t ByteSize(const std::vector<bool, A>& v)
+	{
+		return VarintLength(v.size()) + (v.size() + 7) / 8;
+	}
 };
 
+template<std::size_t N>
+class K3Serializer<std::bitset<N>>
+{
+	static constexpr std::size_t kBytes = (N + 7) / 8;
+public:
+	template<typename Dst>
+	static void PutValue(Dst& dst, const std::bitset<N>& v)
+	{
+		std::array<char, kBytes> buf = {};
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			if (v[i])
+			{
+				buf[i / 8] |= static_cast<char>(1 << (i % 8));
+			}
+		}
+		dst.append(buf.data(), kBytes);
+	}
+	static bool GetValue(std::string_view& src, std::bitset<N>& v)
+	{
+		if (src.size() < kBytes)
+		{
+			return false;
+		}
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			v[i] = ((static_cast<uint8_t>(src[i / 8]) >> (i % 8)) & 1) != 0;
+		}
+		src.remove_prefix(kBytes);
+		return true;
+	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return K3SerializerBase::SkipBytes(src, kBytes);
+	}
+	static std::size_t ByteSize(const std::bitset<N>&)
+	{
+		return kBytes;
+	}
+};
 
-template<typename K, typename V>
-class K3Serializer<std::unordered_map<K, V>> : public K3SerializerVarint32
+template<typename K, typename V, typename H, typename E, typename A>
+class K3Serializer<std::unordered_map<K, V, H, E, A>> : public K3SerializerVarint32
 {
+	using Map = std::unordered_map<K, V, H, E, A>;
 public:
-	static void PutValue(std::string& dst, const std::unordered_map<K,V>& v)
+	template<typename Dst>
+	static void PutValue(Dst& dst, const Map& v)
 	{
 		PutVarint32(dst, static_cast<uint32_t>(v.size()));
+		if constexpr (K3IsLessComparable<K>::value)
+		{
+			if (K3CanonicalScope::IsEnabled() && v.size() > 1)
+			{
+				// sort pointers to the entries, the pairs themselves are never copied
+				std::vector<const typename Map::value_type*> sorted;
+				sorted.reserve(v.size());
+				for (const auto& kv : v)
+				{
+					sorted.push_back(&kv);
+				}
+				std::sort(sorted.begin(), sorted.end(), [](const auto* lhs, const auto* rhs) { return lhs->first < rhs->first; });
+				for (const auto* kv : sorted)
+				{
+					K3Serializer<K>::PutValue(dst, kv->first);
+					K3Serializer<V>::PutValue(dst, kv->second);
+				}
+				return;
+			}
+		}
+		else
+		{
+			// without operator< the entries are ordered by the bytes of their encoded keys
+			if (K3CanonicalScope::IsEnabled() && v.size() > 1)
+			{
+				struct Entry
+				{
+					std::size_t begin;
+					std::size_t size;
+					const typename Map::value_type* kv;
+				};
+				std::string keys;
+				std::vector<Entry> sorted;
+				sorted.reserve(v.size());
+				for (const auto& kv : v)
+				{
+					const std::size_t begin = keys.size();
+					K3Serializer<K>::PutValue(keys, kv.first);
+					sorted.push_back(Entry{begin, keys.size() - begin, &kv});
+				}
+				std::sort(sorted.begin(), sorted.end(), [&keys](const Entry& lhs, const Entry& rhs) {
+					return std::string_view(keys).substr(lhs.begin, lhs.size) < std::string_view(keys).substr(rhs.begin, rhs.size);
+				});
+				for (const Entry& entry : sorted)
+				{
+					dst.append(keys.data() + entry.begin, entry.size);
+					K3Serializer<V>::PutValue(dst, entry.kv->second);
+				}
+				return;
+			}
+		}
 		for (const auto& kv : v)
 		{
 			K3Serializer<K>::PutValue(dst, kv.first);
 			K3Serializer<V>::PutValue(dst, kv.second);
 		}
 	}
-	static bool GetValue(std::string_view& src, std::unordered_map<K, V>& v)
+	static bool GetValue(std::string_view& src, Map& v)
 	{
 		uint32_t vsize;
 		if (!GetVarint32(src, &vsize))
@@ -387,54 +1590,948 @@ public:
 		}
 		for (uint32_t i = 0; i < vsize; ++i)
 		{
-			std::pair<K, V> kv;
-			if (!K3Serializer<K>::GetValue(src, kv.first))
+			// the value is decoded in place inside the node, so both key and value
+			// end up in the map's allocator (e.g. a pmr arena) without extra copies
+			K key = K3MakeUsingAllocator<K>(v.get_allocator());
+			if (!K3Serializer<K>::GetValue(src, key))
 			{
 				return false;
 			}
-			if (!K3Serializer<V>::GetValue(src, kv.second))
+			auto [it, inserted] = v.try_emplace(std::move(key));
+			if (inserted)
+			{
+				if (!K3Serializer<V>::GetValue(src, it->second))
+				{
+					return false;
+				}
+			}
+			else
+			{
+				// duplicated key: the first one wins
+				V ignored = K3MakeUsingAllocator<V>(v.get_allocator());
+				if (!K3Serializer<V>::GetValue(src, ignored))
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+	static bool SkipValue(std::string_view& src)
+	{
+		uint32_t vsize;
+		if (!GetVarint32(src, &vsize))
+		{
+			return false;
+		}
+		for (uint32_t i = 0; i < vsize; ++i)
+		{
+			if (!K3SkipValue<K>(src) || !K3SkipValue<V>(src))
 			{
 				return false;
 			}
-			v.insert(std::move(kv));
 		}
 		return true;
 	}
+	static std::size_t ByteSize(const Map& v)
+	{
+		std::size_t size = VarintLength(v.size());
+		for (const auto& kv : v)
+		{
+			size += K3ByteSize<K>(kv.first) + K3ByteSize<V>(kv.second);
+		}
+		return size;
+	}
 };
 
 
-template<typename T, typename = std::enable_if_t<std::is_class_v<T>>>
-class K3SerializerClass
+template<typename T>
+class K3Serializer<std::optional<T>> : public K3SerializerByte
 {
 public:
-	static void PutValue(std::string& dst, const T& obj)
+	template<typename Dst>
+	static void PutValue(Dst& dst, const std::optional<T>& v)
 	{
-		if constexpr (!std::is_same_v<typename T::SuperClass, void>)
+		PutByte(dst, v.has_value() ? 1 : 0);
+		if (v.has_value())
 		{
-			K3Serializer<typename T::SuperClass>::PutValue(dst, obj);
+			K3Serializer<T>::PutValue(dst, *v);
 		}
-		constexpr auto memberSize = std::tuple_size_v<decltype(T::kMetaClassMember)>;
-		PutMember(dst, &obj, T::kMetaClassMember, std::make_index_sequence<memberSize>{});
 	}
-	static bool GetValue(std::string_view& src, T& obj)
-	{		
-		bool result = true;
-		if constexpr (!std::is_same_v<typename T::SuperClass, void>)
+	static bool GetValue(std::string_view& src, std::optional<T>& v)
+	{
+		uint8_t present;
+		if (!GetByte(src, &present) || present > 1)
 		{
-			result = result && K3Serializer<typename T::SuperClass>::GetValue(src, obj);
+			return false;
 		}
-		constexpr auto memberSize = std::tuple_size_v<decltype(T::kMetaClassMember)>;
-		return result && GetMember(src, &obj, T::kMetaClassMember, std::make_index_sequence<memberSize>{});
-	}
-protected:
-	template <typename O, typename... Args, std::size_t... Idx>
-	static void PutMember(std::string& dst, const O* o, const std::tuple<Args...>& t, std::index_sequence<Idx...>)
+		if (present == 0)
+		{
+			v.reset();
+			return true;
+		}
+		return K3Serializer<T>::GetValue(src, v.emplace());
+	}
+	static bool SkipValue(std::string_view& src)
+	{
+		uint8_t present;
+		if (!GetByte(src, &present) || present > 1)
+		{
+			return false;
+		}
+		return present == 0 || K3SkipValue<T>(src);
+	}
+	static std::size_t ByteSize(const std::optional<T>& v)
+	{
+		return 1 + (v.has_value() ? K3ByteSize<T>(*v) : 0);
+	}
+};
+
+template<typename... Ts>
+class K3Serializer<std::variant<Ts...>> : public K3SerializerVarint32
+{
+	using Variant = std::variant<Ts...>;
+public:
+	template<typename Dst>
+	static void PutValue(Dst& dst, const Variant& v)
+	{
+		PutVarint32(dst, static_cast<uint32_t>(v.index()));
+		std::visit([&dst](const auto& e) { K3Serializer<std::decay_t<decltype(e)>>::PutValue(dst, e); }, v);
+	}
+	static bool GetValue(std::string_view& src, Variant& v)
+	{
+		static constexpr auto kGetAlternative = MakeGetTable(std::index_sequence_for<Ts...>{});
+		uint32_t index;
+		if (!GetVarint32(src, &index) || index >= sizeof...(Ts))
+		{
+			return false;
+		}
+		return kGetAlternative[index](src, v);
+	}
+	static bool SkipValue(std::string_view& src)
+	{
+		static constexpr std::array<bool(*)(std::string_view&), sizeof...(Ts)> kSkipAlternative = { &K3SkipValue<Ts>... };
+		uint32_t index;
+		if (!GetVarint32(src, &index) || index >= sizeof...(Ts))
+		{
+			return false;
+		}
+		return kSkipAlternative[index](src);
+	}
+	static std::size_t ByteSize(const Variant& v)
+	{
+		return VarintLength(v.index()) + std::visit([](const auto& e) { return K3ByteSize<std::decay_t<decltype(e)>>(e); }, v);
+	}
+protected:
+	template<std::size_t Idx>
+	static bool GetAlternative(std::string_view& src, Variant& v)
+	{
+		return K3Serializer<std::variant_alternative_t<Idx, Variant>>::GetValue(src, v.template emplace<Idx>());
+	}
+	template<std::size_t... Idx>
+	static constexpr auto MakeGetTable(std::index_sequence<Idx...>)
+	{
+		return std::array<bool(*)(std::string_view&, Variant&), sizeof...(Idx)>{ &GetAlternative<Idx>... };
+	}
+};
+
+template<typename T1, typename T2>
+class K3Serializer<std::pair<T1, T2>>
+{
+public:
+	template<typename Dst>
+	static void PutValue(Dst& dst, const std::pair<T1, T2>& v)
+	{
+		K3Serializer<T1>::PutValue(dst, v.first);
+		K3Serializer<T2>::PutValue(dst, v.second);
+	}
+	static bool GetValue(std::string_view& src, std::pair<T1, T2>& v)
+	{
+		return K3Serializer<T1>::GetValue(src, v.first) && K3Serializer<T2>::GetValue(src, v.second);
+	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return K3SkipValue<T1>(src) && K3SkipValue<T2>(src);
+	}
+	static std::size_t ByteSize(const std::pair<T1, T2>& v)
+	{
+		return K3ByteSize<T1>(v.first) + K3ByteSize<T2>(v.second);
+	}
+};
+
+template<typename... Ts>
+class K3Serializer<std::tuple<Ts...>>
+{
+public:
+	template<typename Dst>
+	static void PutValue(Dst& dst, const std::tuple<Ts...>& v)
+	{
+		PutElement(dst, v, std::index_sequence_for<Ts...>{});
+	}
+	static bool GetValue(std::string_view& src, std::tuple<Ts...>& v)
+	{
+		return GetElement(src, v, std::index_sequence_for<Ts...>{});
+	}
+	static bool SkipValue(std::string_view& src)
+	{
+		return (K3SkipValue<Ts>(src) && ...);
+	}
+	static std::size_t ByteSize(const std::tuple<Ts...>& v)
+	{
+		return std::apply([](const auto&... e) { return (std::size_t(0) + ... + K3ByteSize<Ts>(e)); }, v);
+	}
+protected:
+	template <typename Dst, std::size_t... Idx>
+	static void PutElement(Dst& dst, const std::tuple<Ts...>& t, std::index_sequence<Idx...>)
+	{
+		(K3Serializer<Ts>::PutValue(dst, std::get<Idx>(t)), ...);
+	}
+	template <std::size_t... Idx>
+	static bool GetElement(std::string_view& src, std::tuple<Ts...>& t, std::index_sequence<Idx...>)
+	{
+		return (K3Serializer<Ts>::GetValue(src, std::get<Idx>(t)) && ...);
+	}
+};
+
+// the size is part of the type, so no length prefix is written
+template<typename T, std::size_t N>
+class K3Serializer<std::array<T, N>>
+{
+	static constexpr bool kIsByte = std::is_same_v<T, char> || std::is_same_v<T, int8_t> || std::is_same_v<T, uint8_t>;
+public:
+	template<typename Dst>
+	static void PutValue(Dst& dst, const std::array<T, N>& v)
+	{
+		if constexpr (kIsByte)
+		{
+			K3SerializerBase::PutPayload(dst, reinterpret_cast<const char*>(v.data()), N);
+		}
+		else
+		{
+			for (const auto& e : v)
+			{
+				K3Serializer<T>::PutValue(dst, e);
+			}
+		}
+	}
+	static bool GetValue(std::string_view& src, std::array<T, N>& v)
+	{
+		if constexpr (kIsByte)
+		{
+			if (src.size() < N)
+			{
+				return false;
+			}
+			memcpy(v.data(), src.data(), N);
+			src.remove_prefix(N);
+			return true;
+		}
+		else
+		{
+			for (auto& e : v)
+			{
+				if (!K3Serializer<T>::GetValue(src, e))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+	}
+	static bool SkipValue(std::string_view& src)
+	{
+		if constexpr (kIsByte)
+		{
+			return K3SerializerBase::SkipBytes(src, N);
+		}
+		else
+		{
+			for (std::size_t i = 0; i < N; ++i)
+			{
+				if (!K3SkipValue<T>(src))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+	}
+	static std::size_t ByteSize(const std::array<T, N>& v)
+	{
+		if constexpr (kIsByte)
+		{
+			return N;
+		}
+		else
+		{
+			std::size_t size = 0;
+			for (const auto& e : v)
+			{
+				size += K3ByteSize<T>(e);
+			}
+			return size;
+		}
+	}
+};
+
+template<typename P>
+struct K3MemberPointer;
+template<typename C, typename M>
+struct K3MemberPointer<M C::*>
+{
+	using ClassType = C;
+	using MemberType = M;
+};
+
+template<typename Tuple, std::size_t... Idx>
+constexpr std::array<bool, sizeof...(Idx)> K3BoolMemberMask(std::index_sequence<Idx...>)
+{
+	return { { std::is_same_v<typename K3MemberPointer<std::tuple_element_t<Idx, Tuple>>::MemberType, bool>... } };
+}
+
+// Consecutive bool members are packed into bitfield bytes of up to 8 flags. Returns how many
+// bools the byte starting at member idx holds, or 0 if no byte starts there.
+template<std::size_t N>
+constexpr std::size_t K3BoolPackLength(const std::array<bool, N>& mask, std::size_t idx)
+{
+	if (!mask[idx])
+	{
+		return 0;
+	}
+	std::size_t offset = 0;
+	for (std::size_t i = idx; i > 0 && mask[i - 1]; --i)
+	{
+		++offset;
+	}
+	if (offset % 8 != 0)
+	{
+		return 0;
+	}
+	std::size_t len = 0;
+	while (len < 8 && idx + len < N && mask[idx + len])
+	{
+		++len;
+	}
+	return len;
+}
+
+template<std::size_t N>
+constexpr std::size_t K3BoolPackLeader(const std::array<bool, N>& mask, std::size_t idx)
+{
+	while (mask[idx] && K3BoolPackLength(mask, idx) == 0)
+	{
+		--idx;
+	}
+	return idx;
+}
+
+template<typename A, typename B>
+constexpr bool K3SameMember(A lhs, B rhs)
+{
+	if constexpr (std::is_same_v<A, B>)
+	{
+		return lhs == rhs;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+// Index of the member pointer M in T::kMetaClassMember, or the tuple size if M is not listed.
+template<typename T, auto M, std::size_t... Idx>
+constexpr std::size_t K3MemberIndex(std::index_sequence<Idx...>)
+{
+	std::size_t index = sizeof...(Idx);
+	static_cast<void>(((K3SameMember(std::get<Idx>(T::kMetaClassMember), M) ? (index = Idx, true) : false) || ...));
+	return index;
+}
+
+// Whether the member pointer M is listed in the kMetaClassMember of T or of a super class.
+template<typename T, auto M>
+constexpr bool K3ChainHasMember()
+{
+	if constexpr (std::is_same_v<T, void>)
+	{
+		return false;
+	}
+	else
+	{
+		constexpr std::size_t size = std::tuple_size_v<std::remove_const_t<decltype(T::kMetaClassMember)>>;
+		return K3MemberIndex<T, M>(std::make_index_sequence<size>{}) < size || K3ChainHasMember<typename T::SuperClass, M>();
+	}
+}
+
+// Number of reflected members of T and all its super classes.
+template<typename T>
+constexpr std::size_t K3ChainMemberCount()
+{
+	if constexpr (std::is_same_v<T, void>)
+	{
+		return 0;
+	}
+	else
+	{
+		return std::tuple_size_v<std::remove_const_t<decltype(T::kMetaClassMember)>> + K3ChainMemberCount<typename T::SuperClass>();
+	}
+}
+
+// Opt-in wire policies of a reflected class, declared next to kMetaClassMember:
+//   static constexpr inline uint32_t kMetaClassPolicy = K3ClassPolicy::kLengthPrefixed;
+// Policies apply where the class is serialized as a value, not as the super class part of
+// a derived class.
+struct K3ClassPolicy
+{
+	// payload preceded by its varint length: the object can be skipped in O(1), decoded
+	// apart from its siblings, and trailing members it does not know are ignored.
+	// The prefix is computed with a size pass over the object before it is written, and each
+	// length-prefixed object nested in it repeats that pass for its own subtree: encoding
+	// costs one size pass per length-prefixed level above a member, O(depth^2) for a chain of
+	// nested prefixed classes. Put the policy on the classes that are skipped or decoded
+	// apart, not on every level.
+	static constexpr uint32_t kLengthPrefixed = 1 << 0;
+	// the integer and varint enum members the class declares use the prefix-varint format
+	// (K3SerializerPrefix); those of its super classes follow their own policy
+	static constexpr uint32_t kPrefixVarint = 1 << 1;
+};
+
+template<typename T, typename = void>
+struct K3MetaClassPolicy : std::integral_constant<uint32_t, 0> {};
+template<typename T>
+struct K3MetaClassPolicy<T, std::void_t<decltype(T::kMetaClassPolicy)>> : std::integral_constant<uint32_t, T::kMetaClassPolicy> {};
+
+template<typename T, typename = std::enable_if_t<std::is_class_v<T>>>
+class K3SerializerClass;
+
+// Whether K3Serializer<T> is generated from T's meta class, i.e. provides PutBody() & co.
+template<typename T>
+struct K3IsClassSerializer : std::is_base_of<K3SerializerClass<T>, K3Serializer<T>> {};
+
+template<typename T, typename>
+class K3SerializerClass
+{
+	using MetaMember = std::remove_const_t<decltype(T::kMetaClassMember)>;
+	static constexpr std::size_t kMemberSize = std::tuple_size_v<MetaMember>;
+	static constexpr auto kBoolMask = K3BoolMemberMask<MetaMember>(std::make_index_sequence<kMemberSize>{});
+	static constexpr bool kLengthPrefixed = (K3MetaClassPolicy<T>::value & K3ClassPolicy::kLengthPrefixed) != 0;
+	static constexpr bool kPrefixVarint = (K3MetaClassPolicy<T>::value & K3ClassPolicy::kPrefixVarint) != 0;
+	template<std::size_t Idx>
+	using MemberType = typename K3MemberPointer<std::tuple_element_t<Idx, MetaMember>>::MemberType;
+	template<std::size_t Idx>
+	static constexpr bool kPrefixMember = kPrefixVarint && K3IsVarint<MemberType<Idx>>::value;
+	template<std::size_t Idx>
+	using MemberSerializer = std::conditional_t<kPrefixMember<Idx>, K3SerializerPrefix<MemberType<Idx>>, K3Serializer<MemberType<Idx>>>;
+public:
+	template<typename Dst>
+	static void PutValue(Dst& dst, const T& obj)
+	{
+		K3_INSTRUMENT_PUT((K3Instrument::Of<T>()), dst);
+		if constexpr (kLengthPrefixed)
+		{
+			// a full size pass of the subtree, see K3ClassPolicy::kLengthPrefixed for its cost
+			K3Serializer<uint32_t>::PutValue(dst, static_cast<uint32_t>(BodySize(obj)));
+		}
+		PutBody(dst, obj);
+	}
+	static bool GetValue(std::string_view& src, T& obj)
+	{
+		K3_INSTRUMENT_GET((K3Instrument::Of<T>()), src);
+		if constexpr (kLengthPrefixed)
+		{
+			uint32_t len;
+			if (!K3Serializer<uint32_t>::GetValue(src, len) || src.size() < len)
+			{
+				return false;
+			}
+			std::string_view body = src.substr(0, len);
+			src.remove_prefix(len);
+			return GetBody(body, obj);
+		}
+		else
+		{
+			return GetBody(src, obj);
+		}
+	}
+	static bool SkipValue(std::string_view& src)
+	{
+		if constexpr (kLengthPrefixed)
+		{
+			uint32_t len;
+			return K3Serializer<uint32_t>::GetValue(src, len) && K3SerializerBase::SkipBytes(src, len);
+		}
+		else
+		{
+			return SkipBody(src);
+		}
+	}
+	static std::size_t ByteSize(const T& obj)
+	{
+		const std::size_t size = BodySize(obj);
+		return kLengthPrefixed ? K3SerializerBase::VarintLength(size) + size : size;
+	}
+
+	// Encodes count independent messages back to back. A std::string output is grown once for
+	// the whole batch. offsets, when given, gets the count + 1 message boundaries relative to
+	// the start of the batch.
+	template<typename Dst>
+	static void PutBatch(Dst& dst, const T* objs, std::size_t count, std::vector<uint32_t>* offsets = nullptr)
+	{
+		constexpr bool kReserve = std::is_same_v<Dst, std::string>;
+		if (!kReserve && offsets == nullptr)
+		{
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				PutValue(dst, objs[i]);
+			}
+			return;
+		}
+		std::size_t total = 0;
+		if (offsets != nullptr)
+		{
+			offsets->resize(count + 1);
+		}
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			if (offsets != nullptr)
+			{
+				(*offsets)[i] = static_cast<uint32_t>(total);
+			}
+			total += ByteSize(objs[i]);
+		}
+		if (offsets != nullptr)
+		{
+			(*offsets)[count] = static_cast<uint32_t>(total);
+		}
+		if constexpr (kReserve)
+		{
+			const std::size_t base = dst.size();
+			dst.resize(base + total);
+			K3SpanSink sink(&dst[base], total);
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				PutValue(sink, objs[i]);
+			}
+		}
+		else
+		{
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				PutValue(dst, objs[i]);
+			}
+		}
+	}
+	// Decodes count messages written by PutBatch() into objs[0] ... objs[count - 1].
+	static bool GetBatch(std::string_view& src, T* objs, std::size_t count)
+	{
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			if (!GetValue(src, objs[i]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	template<typename A>
+	static bool GetBatch(std::string_view& src, std::vector<T, A>& objs, std::size_t count)
+	{
+		const std::size_t base = objs.size();
+		objs.resize(base + count);
+		return GetBatch(src, objs.data() + base, count);
+	}
+
+	// The super class part followed by the members, without any policy framing. A super class
+	// with a hand-written serializer is written as a whole value.
+	template<typename Dst>
+	static void PutBody(Dst& dst, const T& obj)
+	{
+		using Super = typename T::SuperClass;
+		if constexpr (!std::is_same_v<Super, void>)
+		{
+			if constexpr (K3IsClassSerializer<Super>::value)
+			{
+				K3Serializer<Super>::PutBody(dst, obj);
+			}
+			else
+			{
+				K3Serializer<Super>::PutValue(dst, obj);
+			}
+		}
+		PutMember(dst, obj, std::make_index_sequence<kMemberSize>{});
+	}
+	static bool GetBody(std::string_view& src, T& obj)
+	{
+		using Super = typename T::SuperClass;
+		bool result = true;
+		if constexpr (!std::is_same_v<Super, void>)
+		{
+			if constexpr (K3IsClassSerializer<Super>::value)
+			{
+				result = result && K3Serializer<Super>::GetBody(src, obj);
+			}
+			else
+			{
+				result = result && K3Serializer<Super>::GetValue(src, obj);
+			}
+		}
+		return result && GetMember(src, obj, std::make_index_sequence<kMemberSize>{});
+	}
+	static bool SkipBody(std::string_view& src)
+	{
+		using Super = typename T::SuperClass;
+		if constexpr (!std::is_same_v<Super, void>)
+		{
+			bool skipped;
+			if constexpr (K3IsClassSerializer<Super>::value)
+			{
+				skipped = K3Serializer<Super>::SkipBody(src);
+			}
+			else
+			{
+				skipped = K3SkipValue<Super>(src);
+			}
+			if (!skipped)
+			{
+				return false;
+			}
+		}
+		return SkipMember(src, std::make_index_sequence<kMemberSize>{});
+	}
+	static std::size_t BodySize(const T& obj)
+	{
+		using Super = typename T::SuperClass;
+		std::size_t size = 0;
+		if constexpr (!std::is_same_v<Super, void>)
+		{
+			if constexpr (K3IsClassSerializer<Super>::value)
+			{
+				size += K3Serializer<Super>::BodySize(obj);
+			}
+			else
+			{
+				size += K3ByteSize<Super>(obj);
+			}
+		}
+		return size + MemberSize(obj, std::make_index_sequence<kMemberSize>{});
+	}
+protected:
+	template<typename> friend class K3Lazy;
+	template<typename, auto...> friend class K3Projection;
+	friend class K3SizeReport;
+
+	template <typename Dst, std::size_t... Idx>
+	static void PutMember(Dst& dst, const T& obj, std::index_sequence<Idx...>)
+	{
+		(PutMemberAt<Idx>(dst, obj), ...);
+	}
+	template <std::size_t... Idx>
+	static bool GetMember(std::string_view& src, T& obj, std::index_sequence<Idx...>)
+	{
+		return (GetMemberAt<Idx>(src, obj) && ...);
+	}
+	template <std::size_t... Idx>
+	static bool SkipMember(std::string_view& src, std::index_sequence<Idx...>)
+	{
+		return (SkipMemberAt<Idx>(src) && ...);
+	}
+	template <std::size_t... Idx>
+	static std::size_t MemberSize(const T& obj, std::index_sequence<Idx...>)
+	{
+		return (std::size_t(0) + ... + MemberSizeAt<Idx>(obj));
+	}
+	template <std::size_t Idx, typename Dst>
+	static void PutMemberAt(Dst& dst, const T& obj)
+	{
+		if constexpr (!kBoolMask[Idx])
+		{
+			K3_INSTRUMENT_PUT((K3Instrument::Of<T, Idx, MemberType<Idx>>()), dst);
+			MemberSerializer<Idx>::PutValue(dst, obj.*std::get<Idx>(T::kMetaClassMember));
+		}
+		else if constexpr (K3BoolPackLength(kBoolMask, Idx) > 0)
+		{
+			K3_INSTRUMENT_PUT((K3Instrument::Of<T, Idx, MemberType<Idx>>()), dst);
+			constexpr auto len = K3BoolPackLength(kBoolMask, Idx);
+			dst.push_back(static_cast<char>(PackBool<Idx>(obj, std::make_index_sequence<len>{})));
+		}
+	}
+	template <std::size_t Idx>
+	static bool GetMemberAt(std::string_view& src, T& obj)
+	{
+		if constexpr (!kBoolMask[Idx])
+		{
+			K3_INSTRUMENT_GET((K3Instrument::Of<T, Idx, MemberType<Idx>>()), src);
+			return MemberSerializer<Idx>::GetValue(src, obj.*std::get<Idx>(T::kMetaClassMember));
+		}
+		else if constexpr (K3BoolPackLength(kBoolMask, Idx) > 0)
+		{
+			K3_INSTRUMENT_GET((K3Instrument::Of<T, Idx, MemberType<Idx>>()), src);
+			constexpr auto len = K3BoolPackLength(kBoolMask, Idx);
+			if (src.empty())
+			{
+				return false;
+			}
+			UnpackBool<Idx>(obj, static_cast<uint8_t>(src.front()), std::make_index_sequence<len>{});
+			src.remove_prefix(1);
+			return true;
+		}
+		else
+		{
+			// already decoded with the first bool of its byte
+			return true;
+		}
+	}
+	template <std::size_t Idx>
+	static bool SkipMemberAt(std::string_view& src)
+	{
+		if constexpr (kPrefixMember<Idx>)
+		{
+			return K3SerializerPrefixVarint::SkipPrefixVarint(src);
+		}
+		else if constexpr (!kBoolMask[Idx])
+		{
+			return K3SkipValue<MemberType<Idx>>(src);
+		}
+		else if constexpr (K3BoolPackLength(kBoolMask, Idx) > 0)
+		{
+			return K3SerializerBase::SkipBytes(src, 1);
+		}
+		else
+		{
+			return true;
+		}
+	}
+	template <std::size_t Idx>
+	static std::size_t MemberSizeAt(const T& obj)
+	{
+		if constexpr (kPrefixMember<Idx>)
+		{
+			return K3SerializerPrefix<MemberType<Idx>>::ByteSize(obj.*std::get<Idx>(T::kMetaClassMember));
+		}
+		else if constexpr (!kBoolMask[Idx])
+		{
+			return K3ByteSize<MemberType<Idx>>(obj.*std::get<Idx>(T::kMetaClassMember));
+		}
+		else
+		{
+			return K3BoolPackLength(kBoolMask, Idx) > 0 ? 1 : 0;
+		}
+	}
+	template <std::size_t Idx, std::size_t... Bit>
+	static uint8_t PackBool(const T& obj, std::index_sequence<Bit...>)
+	{
+		return static_cast<uint8_t>(((static_cast<uint32_t>(obj.*std::get<Idx + Bit>(T::kMetaClassMember)) << Bit) | ...));
+	}
+	template <std::size_t Idx, std::size_t... Bit>
+	static void UnpackBool(T& obj, uint8_t bits, std::index_sequence<Bit...>)
+	{
+		((obj.*std::get<Idx + Bit>(T::kMetaClassMember) = ((bits >> Bit) & 1) != 0), ...);
+	}
+};
+
+// Decodes a T whose storage, including the object itself, comes from the memory resource
+// `mr` (e.g. a std::pmr::monotonic_buffer_resource). For the whole tree to live in the arena
+// use std::pmr containers and make reflected classes allocator-aware (allocator_type and a
+// constructor taking it). The object is not destroyed for you: with an arena, releasing the
+// resource frees everything at once. Returns nullptr on malformed input.
+template<typename T>
+class K3ArenaDecoder
+{
+public:
+	static T* GetValue(std::string_view& src, std::pmr::memory_resource* mr)
+	{
+		std::pmr::polymorphic_allocator<T> alloc(mr);
+		T* obj = alloc.allocate(1);
+		alloc.construct(obj);
+		if (!K3Serializer<T>::GetValue(src, *obj))
+		{
+			obj->~T();
+			alloc.deallocate(obj, 1);
+			return nullptr;
+		}
+		return obj;
+	}
+};
+
+// On-demand decoding of a reflected class. Parse() only skims the input, recording the byte
+// range of every member (super classes included); a member is decoded on its first Get().
+// The parsed buffer must outlive the view.
+template<typename T>
+class K3Lazy
+{
+	static constexpr std::size_t kMemberCount = K3ChainMemberCount<T>();
+public:
+	K3Lazy() : decoded_() {}
+
+	bool Parse(std::string_view& src)
+	{
+		obj_ = T();
+		decoded_.fill(false);
+		if constexpr ((K3MetaClassPolicy<T>::value & K3ClassPolicy::kLengthPrefixed) != 0)
+		{
+			uint32_t len;
+			if (!K3Serializer<uint32_t>::GetValue(src, len) || src.size() < len)
+			{
+				return false;
+			}
+			std::string_view body = src.substr(0, len);
+			src.remove_prefix(len);
+			return Skim<T>(body);
+		}
+		else
+		{
+			return Skim<T>(src);
+		}
+	}
+	// Returns nullptr if the member fails to decode.
+	template<auto Member>
+	const typename K3MemberPointer<decltype(Member)>::MemberType* Get()
+	{
+		using C = typename K3MemberPointer<decltype(Member)>::ClassType;
+		using Serializer = K3SerializerClass<C>;
+		constexpr std::size_t size = std::tuple_size_v<std::remove_const_t<decltype(C::kMetaClassMember)>>;
+		constexpr std::size_t idx = K3MemberIndex<C, Member>(std::make_index_sequence<size>{});
+		static_assert(idx < size, "Member is not listed in kMetaClassMember");
+		constexpr std::size_t base = K3ChainMemberCount<typename C::SuperClass>();
+		// bools packed in the same byte are decoded together
+		constexpr std::size_t leader = K3BoolPackLeader(Serializer::kBoolMask, idx);
+		constexpr std::size_t count = std::max<std::size_t>(1, K3BoolPackLength(Serializer::kBoolMask, leader));
+		if (!decoded_[base + idx])
+		{
+			std::string_view input = ranges_[base + leader];
+			if (!Serializer::template GetMemberAt<leader>(input, static_cast<C&>(obj_)))
+			{
+				return nullptr;
+			}
+			std::fill_n(decoded_.begin() + base + leader, count, true);
+		}
+		return &(obj_.*Member);
+	}
+private:
+	template<typename C>
+	bool Skim(std::string_view& src)
+	{
+		if constexpr (!std::is_same_v<typename C::SuperClass, void>)
+		{
+			if (!Skim<typename C::SuperClass>(src))
+			{
+				return false;
+			}
+		}
+		constexpr std::size_t size = std::tuple_size_v<std::remove_const_t<decltype(C::kMetaClassMember)>>;
+		return SkimMember<C>(src, std::make_index_sequence<size>{});
+	}
+	template<typename C, std::size_t... Idx>
+	bool SkimMember(std::string_view& src, std::index_sequence<Idx...>)
+	{
+		return (SkimMemberAt<C, Idx>(src) && ...);
+	}
+	template<typename C, std::size_t Idx>
+	bool SkimMemberAt(std::string_view& src)
+	{
+		const char* begin = src.data();
+		if (!K3SerializerClass<C>::template SkipMemberAt<Idx>(src))
+		{
+			return false;
+		}
+		ranges_[K3ChainMemberCount<typename C::SuperClass>() + Idx] = std::string_view(begin, src.data() - begin);
+		return true;
+	}
+
+	T obj_;
+	std::array<std::string_view, kMemberCount> ranges_;
+	std::array<bool, kMemberCount> decoded_;
+};
+
+// Decodes only the listed members of T (super class members included) and skips the rest:
+//   K3Projection<Person, &Person::age, &Actor::country>::GetValue(src, person);
+// Unlisted members keep their value. Bools packed in the same byte as a listed one are decoded
+// too. For a length-prefixed T nothing after the last listed member is even skipped.
+template<typename T, auto... Members>
+class K3Projection
+{
+	static_assert((K3ChainHasMember<T, Members>() && ...), "Members are not all listed in kMetaClassMember of T or its super classes");
+	static constexpr bool kLengthPrefixed = (K3MetaClassPolicy<T>::value & K3ClassPolicy::kLengthPrefixed) != 0;
+public:
+	static bool GetValue(std::string_view& src, T& obj)
+	{
+		if constexpr (kLengthPrefixed)
+		{
+			uint32_t len;
+			if (!K3Serializer<uint32_t>::GetValue(src, len) || src.size() < len)
+			{
+				return false;
+			}
+			std::string_view body = src.substr(0, len);
+			src.remove_prefix(len);
+			return GetBody<T, true>(body, obj);
+		}
+		else
+		{
+			return GetBody<T, false>(src, obj);
+		}
+	}
+private:
+	template<typename C>
+	static constexpr std::size_t MemberSize()
 	{
-		(K3Serializer<std::remove_const_t<std::remove_reference_t<decltype(o->*std::get<Idx>(t))>>>::PutValue(dst, o->*std::get<Idx>(t)), ...);
+		return std::tuple_size_v<std::remove_const_t<decltype(C::kMetaClassMember)>>;
 	}
-	template <typename O, typename... Args, std::size_t... Idx>
-	static bool GetMember(std::string_view& src, O* o, const std::tuple<Args...>& t, std::index_sequence<Idx...>)
+	template<typename C, std::size_t Idx>
+	static constexpr bool IsSelected()
 	{
-		return (K3Serializer<std::remove_const_t<std::remove_reference_t<decltype(o->*std::get<Idx>(t))>>>::GetValue(src, o->*std::get<Idx>(t)) && ...);
+		return (K3SameMember(std::get<Idx>(C::kMetaClassMember), Members) || ...);
+	}
+	// whether the packed bool byte starting at Idx holds a selected member
+	template<typename C, std::size_t Idx, std::size_t... Bit>
+	static constexpr bool IsPackSelected(std::index_sequence<Bit...>)
+	{
+		return (IsSelected<C, Idx + Bit>() || ...);
+	}
+	template<typename C, std::size_t Idx>
+	static constexpr bool IsLeaderSelected()
+	{
+		constexpr std::size_t count = std::max<std::size_t>(1, K3BoolPackLength(K3SerializerClass<C>::kBoolMask, Idx));
+		return IsPackSelected<C, Idx>(std::make_index_sequence<count>{});
+	}
+	template<typename C, std::size_t... Idx>
+	static constexpr std::size_t LastSelected(std::index_sequence<Idx...>)
+	{
+		std::size_t last = 0;
+		((last = IsLeaderSelected<C, Idx>() ? Idx + 1 : last), ...);
+		return last;
+	}
+
+	template<typename C, bool kStopEarly>
+	static bool GetBody(std::string_view& src, T& obj)
+	{
+		if constexpr (!std::is_same_v<typename C::SuperClass, void>)
+		{
+			if (!GetBody<typename C::SuperClass, false>(src, obj))
+			{
+				return false;
+			}
+		}
+		return GetMember<C, kStopEarly>(src, obj, std::make_index_sequence<MemberSize<C>()>{});
+	}
+	template<typename C, bool kStopEarly, std::size_t... Idx>
+	static bool GetMember(std::string_view& src, T& obj, std::index_sequence<Idx...>)
+	{
+		return (GetMemberAt<C, kStopEarly, Idx>(src, obj) && ...);
+	}
+	template<typename C, bool kStopEarly, std::size_t Idx>
+	static bool GetMemberAt(std::string_view& src, T& obj)
+	{
+		if constexpr (kStopEarly && Idx >= LastSelected<C>(std::make_index_sequence<MemberSize<C>()>{}))
+		{
+			return true;
+		}
+		else if constexpr (IsLeaderSelected<C, Idx>())
+		{
+			return K3SerializerClass<C>::template GetMemberAt<Idx>(src, static_cast<C&>(obj));
+		}
+		else
+		{
+			return K3SerializerClass<C>::template SkipMemberAt<Idx>(src);
+		}
 	}
 };
@@ -0,0 +1,283 @@
+#pragma once
+#include "k3serializer.h"
+
+// C++20 coroutine adaptor; compiles to nothing in C++17 builds. Define K3SERIALIZER_COROUTINES
+// to 0 to leave it out of a C++20 build as well.
+#if !defined(K3SERIALIZER_COROUTINES) && defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define K3SERIALIZER_COROUTINES 1
+#endif
+#endif
+
+#if K3SERIALIZER_COROUTINES
+#include <cassert>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <errno.h>
+#include <unistd.h>
+
+// Coroutine type for a decoding session. It starts running right away and runs until its
+// first suspension; destroying the task destroys a session still suspended.
+class K3Task
+{
+public:
+	struct promise_type
+	{
+		K3Task get_return_object() { return K3Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	K3Task(K3Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+	K3Task& operator=(K3Task&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (handle_)
+			{
+				handle_.destroy();
+			}
+			handle_ = std::exchange(other.handle_, {});
+		}
+		return *this;
+	}
+	~K3Task()
+	{
+		if (handle_)
+		{
+			handle_.destroy();
+		}
+	}
+
+	bool done() const { return !handle_ || handle_.done(); }
+private:
+	explicit K3Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+	std::coroutine_handle<promise_type> handle_;
+};
+
+// Decodes values from a byte stream that arrives piecemeal, e.g. from a non-blocking socket
+// driven by an event loop. `co_await reader.get<T>()` yields the next T as a std::optional,
+// suspending while the buffered input holds only part of it; the Feed() that completes it
+// resumes the session before returning. The result is empty once the stream has ended
+// (Close(), or end of file in FeedFrom()) and on malformed input, after which failed() is set
+// and every later get() is empty too.
+//
+// Whether a whole value is buffered is probed with SkipValue(), which builds nothing, and the
+// value is then decoded with its regular GetValue(). Each probe walks the partial value from
+// its start, so after a failed one, feeds flagged `more` wait until the buffered bytes have
+// doubled before probing again; a plain Feed(), or FeedFrom() running out of input, always
+// probes. A length-prefixed class (K3ClassPolicy::kLengthPrefixed) is not probed before the
+// bytes its prefix announces have arrived. A partial value longer than maxMessage
+// counts as malformed rather than being waited for. One session awaits a reader at a time;
+// destroying it while suspended detaches it from the reader, which must outlive it.
+class K3AsyncReader
+{
+public:
+	static constexpr std::size_t kReadChunk = 64 * 1024;
+
+	explicit K3AsyncReader(std::size_t maxMessage = 64 << 20) : maxMessage_(maxMessage) {}
+	K3AsyncReader(const K3AsyncReader&) = delete;
+	K3AsyncReader& operator=(const K3AsyncReader&) = delete;
+
+	template<typename T>
+	class Awaiter
+	{
+	public:
+		explicit Awaiter(K3AsyncReader& reader) : reader_(reader) {}
+		// a session destroyed while suspended must not be resumed by a later Feed()
+		~Awaiter() { reader_.Withdraw(this); }
+		Awaiter(const Awaiter&) = delete;
+		Awaiter& operator=(const Awaiter&) = delete;
+
+		bool await_ready() { return reader_.TryGet(result_); }
+		void await_suspend(std::coroutine_handle<> session) { reader_.Suspend(session, this, &Awaiter::Attempt); }
+		std::optional<T> await_resume() { return std::move(result_); }
+	private:
+		static bool Attempt(void* self)
+		{
+			Awaiter* awaiter = static_cast<Awaiter*>(self);
+			return awaiter->reader_.TryGet(awaiter->result_);
+		}
+
+		K3AsyncReader& reader_;
+		std::optional<T> result_;
+	};
+
+	template<typename T>
+	Awaiter<T> get() { return Awaiter<T>(*this); }
+
+	// more: further bytes are about to follow, so a probe can be put off.
+	void Feed(const char* data, std::size_t size, bool more = false)
+	{
+		buffer_.append(data, size);
+		Resume(!more);
+	}
+	// Feeds whatever a non-blocking fd has available. Returns false once the peer has closed
+	// the stream or on a read error; the reader is closed then.
+	bool FeedFrom(int fd)
+	{
+		char chunk[kReadChunk];
+		for (;;)
+		{
+			ssize_t n = ::read(fd, chunk, sizeof(chunk));
+			if (n > 0)
+			{
+				Feed(chunk, static_cast<std::size_t>(n), true);
+				continue;
+			}
+			if (n < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				Resume(true);
+				return true;
+			}
+			Close();
+			return false;
+		}
+	}
+	// No more input follows; a session waiting for it resumes with an empty result.
+	void Close()
+	{
+		closed_ = true;
+		Resume(true);
+	}
+
+	bool closed() const { return closed_; }
+	bool failed() const { return failed_; }
+	bool waiting() const { return static_cast<bool>(session_); }
+	std::size_t buffered() const { return buffer_.size() - consumed_; }
+	// completeness probes (SkipValue or GetValue walks) run so far
+	std::size_t probes() const { return probes_; }
+private:
+	// Returns false if T is not complete yet, true once result holds it or is empty for good.
+	template<typename T>
+	bool TryGet(std::optional<T>& result)
+	{
+		result.reset();
+		std::string_view input(buffer_.data() + consumed_, buffered());
+		if (failed_ || (closed_ && input.empty()))
+		{
+			return true;
+		}
+		if (input.empty())
+		{
+			return Incomplete(0, 0);
+		}
+		if constexpr ((K3MetaClassPolicy<T>::value & K3ClassPolicy::kLengthPrefixed) != 0)
+		{
+			std::string_view body = input;
+			uint32_t len;
+			if (!K3Serializer<uint32_t>::GetValue(body, len))
+			{
+				return Incomplete(input.size(), 0);
+			}
+			if (body.size() < len)
+			{
+				return Incomplete(input.size(), input.size() - body.size() + len);
+			}
+		}
+		++probes_;
+		if constexpr (K3HasSkipValue<T>::value)
+		{
+			std::string_view probe = input;
+			if (!K3Serializer<T>::SkipValue(probe))
+			{
+				return Incomplete(input.size(), 0);
+			}
+		}
+		std::string_view src = input;
+		result.emplace();
+		if (!K3Serializer<T>::GetValue(src, *result))
+		{
+			result.reset();
+			if constexpr (K3HasSkipValue<T>::value)
+			{
+				failed_ = true;
+				return true;
+			}
+			else
+			{
+				return Incomplete(input.size(), 0);
+			}
+		}
+		Consume(input.size() - src.size());
+		return true;
+	}
+	// needed: exact size of the value if known, 0 otherwise
+	bool Incomplete(std::size_t size, std::size_t needed)
+	{
+		if (!closed_ && std::max(size, needed) <= maxMessage_)
+		{
+			probeAt_ = needed != 0 ? needed : size * 2;
+			exact_ = needed != 0;
+			return false;
+		}
+		failed_ = true;
+		return true;
+	}
+	void Consume(std::size_t size)
+	{
+		probeAt_ = 0;
+		exact_ = false;
+		consumed_ += size;
+		if (consumed_ == buffer_.size())
+		{
+			buffer_.clear();
+			consumed_ = 0;
+		}
+		else if (consumed_ >= kReadChunk && consumed_ >= buffer_.size() / 2)
+		{
+			buffer_.erase(0, consumed_);
+			consumed_ = 0;
+		}
+	}
+	void Suspend(std::coroutine_handle<> session, void* awaiter, bool (*attempt)(void*))
+	{
+		assert(!session_ && "K3AsyncReader: one session at a time");
+		session_ = session;
+		awaiter_ = awaiter;
+		attempt_ = attempt;
+	}
+	void Withdraw(void* awaiter)
+	{
+		if (awaiter_ == awaiter)
+		{
+			session_ = {};
+			awaiter_ = nullptr;
+			attempt_ = nullptr;
+		}
+	}
+	// force: probe even below the doubled watermark, though never below an exact size
+	void Resume(bool force)
+	{
+		const bool due = buffered() >= probeAt_ || (force && !exact_) || closed_;
+		if (session_ && due && attempt_(awaiter_))
+		{
+			std::coroutine_handle<> session = std::exchange(session_, {});
+			awaiter_ = nullptr;
+			attempt_ = nullptr;
+			session.resume();
+		}
+	}
+
+	std::string buffer_;
+	std::size_t consumed_ = 0;
+	std::size_t maxMessage_;
+	std::size_t probeAt_ = 0;
+	std::size_t probes_ = 0;
+	bool exact_ = false;
+	bool closed_ = false;
+	bool failed_ = false;
+	std::coroutine_handle<> session_;
+	void* awaiter_ = nullptr;
+	bool (*attempt_)(void*) = nullptr;
+};
+#endif
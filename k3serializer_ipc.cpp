@@ -0,0 +1,251 @@
+#include "k3serializer_ipc.h"
+
+#if defined(__linux__)
+#include <chrono>
+#include <climits>
+#include <new>
+#include <thread>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Lives at the start of the mapping, followed by the ring. The sequence words are bumped on
+// every commit and release; a sleeper passes the value it last saw to FUTEX_WAIT, so a bump
+// that lands between its check and its sleep wakes it at once.
+struct K3IpcChannel::Shared
+{
+	std::atomic<uint32_t> magic;
+	uint64_t capacity;
+	alignas(64) std::atomic<uint32_t> dataSeq;
+	std::atomic<uint32_t> consumerWaiting;
+	alignas(64) std::atomic<uint32_t> spaceSeq;
+	std::atomic<uint32_t> producersWaiting;
+};
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+	// room for K3IpcChannel::Shared, keeping the ring 64-byte aligned
+	constexpr std::size_t kSharedSize = 192;
+
+	void CpuRelax()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#endif
+	}
+	void FutexWake(std::atomic<uint32_t>* word, int count)
+	{
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, count, nullptr, nullptr, 0);
+	}
+	// Sleeps while *word still holds expected, at most until deadline unless timeoutMs < 0.
+	// Returns false if the deadline has passed.
+	bool FutexWait(std::atomic<uint32_t>* word, uint32_t expected, int timeoutMs, Clock::time_point deadline)
+	{
+		timespec relative;
+		timespec* timeout = nullptr;
+		if (timeoutMs >= 0) {
+			const auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - Clock::now()).count();
+			if (left <= 0) {
+				return false;
+			}
+			relative.tv_sec = static_cast<time_t>(left / 1000000000);
+			relative.tv_nsec = static_cast<long>(left % 1000000000);
+			timeout = &relative;
+		}
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, timeout, nullptr, 0);
+		return true;
+	}
+	// with a single CPU the other side cannot make progress while we spin
+	int SpinIterations()
+	{
+		static const int iterations = std::thread::hardware_concurrency() > 1 ? K3IpcChannel::kSpinIterations : 0;
+		return iterations;
+	}
+}
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "futex words need lock-free 32-bit atomics");
+
+bool K3IpcChannel::Create(std::size_t capacity)
+{
+	Close();
+	return Map(::memfd_create("k3serializer", MFD_CLOEXEC), capacity, true);
+}
+bool K3IpcChannel::Create(const std::string& name, std::size_t capacity)
+{
+	Close();
+	const int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		return false;
+	}
+	if (!Map(fd, capacity, true)) {
+		::shm_unlink(name.c_str());
+		return false;
+	}
+	return true;
+}
+bool K3IpcChannel::Open(const std::string& name)
+{
+	Close();
+	return Map(::shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0), 0, false);
+}
+bool K3IpcChannel::Attach(int fd)
+{
+	Close();
+	return Map(fd, 0, false);
+}
+bool K3IpcChannel::Unlink(const std::string& name)
+{
+	return ::shm_unlink(name.c_str()) == 0;
+}
+bool K3IpcChannel::Map(int fd, std::size_t capacity, bool initialize)
+{
+	static_assert(sizeof(Shared) <= kSharedSize, "shared header outgrew its slot");
+	if (fd < 0) {
+		return false;
+	}
+	fd_ = fd;
+	if (initialize) {
+		if (capacity < K3FrameRing::kMinCapacity || (capacity & (capacity - 1)) != 0) {
+			Close();
+			return false;
+		}
+		mappingSize_ = kSharedSize + K3FrameRing::MemorySize(capacity);
+		if (::ftruncate(fd, static_cast<off_t>(mappingSize_)) != 0) {
+			Close();
+			return false;
+		}
+	}
+	else {
+		struct stat st;
+		if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < kSharedSize) {
+			Close();
+			return false;
+		}
+		mappingSize_ = static_cast<std::size_t>(st.st_size);
+	}
+	void* mapping = ::mmap(nullptr, mappingSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED) {
+		Close();
+		return false;
+	}
+	mapping_ = mapping;
+	char* ringMemory = static_cast<char*>(mapping) + kSharedSize;
+	if (initialize) {
+		shared_ = new (mapping) Shared();
+		shared_->capacity = capacity;
+		ring_.reset(new K3FrameRing(ringMemory, capacity, true));
+		// published last: a party attaching earlier sees no magic and fails
+		shared_->magic.store(kMagic, std::memory_order_release);
+		return true;
+	}
+	shared_ = static_cast<Shared*>(mapping);
+	capacity = shared_->magic.load(std::memory_order_acquire) == kMagic ? shared_->capacity : 0;
+	if (capacity < K3FrameRing::kMinCapacity || (capacity & (capacity - 1)) != 0
+		|| mappingSize_ != kSharedSize + K3FrameRing::MemorySize(capacity)) {
+		Close();
+		return false;
+	}
+	ring_.reset(new K3FrameRing(ringMemory, capacity, false));
+	return true;
+}
+void K3IpcChannel::Close()
+{
+	ring_.reset();
+	if (mapping_ != nullptr) {
+		::munmap(mapping_, mappingSize_);
+	}
+	if (fd_ >= 0) {
+		::close(fd_);
+	}
+	fd_ = -1;
+	mapping_ = nullptr;
+	mappingSize_ = 0;
+	shared_ = nullptr;
+}
+bool K3IpcChannel::Reserve(std::size_t size, K3FrameRing::Reservation* reservation, int timeoutMs)
+{
+	// a larger frame would never fit, waiting for room would not help
+	if (!ring_ || size > ring_->maxPayload()) {
+		return false;
+	}
+	const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs < 0 ? 0 : timeoutMs);
+	const int spins = SpinIterations();
+	for (int spin = 0;; ++spin) {
+		if (ring_->TryReserve(size, reservation)) {
+			return true;
+		}
+		if (spin < spins) {
+			CpuRelax();
+			continue;
+		}
+		const uint32_t seq = shared_->spaceSeq.load();
+		shared_->producersWaiting.fetch_add(1);
+		const bool reserved = ring_->TryReserve(size, reservation);
+		const bool waited = reserved || FutexWait(&shared_->spaceSeq, seq, timeoutMs, deadline);
+		shared_->producersWaiting.fetch_sub(1);
+		if (reserved) {
+			return true;
+		}
+		if (!waited) {
+			return false;
+		}
+	}
+}
+void K3IpcChannel::Commit(const K3FrameRing::Reservation& reservation)
+{
+	ring_->Commit(reservation);
+	shared_->dataSeq.fetch_add(1);
+	if (shared_->consumerWaiting.load() != 0) {
+		FutexWake(&shared_->dataSeq, 1);
+	}
+}
+std::size_t K3IpcChannel::Receive(std::vector<std::string_view>* frames, std::size_t maxFrames, int timeoutMs)
+{
+	if (!ring_ || maxFrames == 0) {
+		return 0;
+	}
+	peeked_.clear();
+	const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs < 0 ? 0 : timeoutMs);
+	const int spins = SpinIterations();
+	for (int spin = 0;; ++spin) {
+		if (ring_->Peek(&peeked_, maxFrames) != 0) {
+			break;
+		}
+		if (spin < spins) {
+			CpuRelax();
+			continue;
+		}
+		const uint32_t seq = shared_->dataSeq.load();
+		shared_->consumerWaiting.store(1);
+		const bool peeked = ring_->Peek(&peeked_, maxFrames) != 0;
+		const bool waited = peeked || FutexWait(&shared_->dataSeq, seq, timeoutMs, deadline);
+		shared_->consumerWaiting.store(0);
+		if (peeked) {
+			break;
+		}
+		if (!waited) {
+			return 0;
+		}
+	}
+	for (const iovec& frame : peeked_) {
+		frames->emplace_back(static_cast<const char*>(frame.iov_base), frame.iov_len);
+	}
+	return peeked_.size();
+}
+void K3IpcChannel::Release()
+{
+	if (!ring_) {
+		return;
+	}
+	ring_->Release();
+	shared_->spaceSeq.fetch_add(1);
+	if (shared_->producersWaiting.load() != 0) {
+		FutexWake(&shared_->spaceSeq, INT_MAX);
+	}
+}
+#endif
@@ -0,0 +1,93 @@
+#pragma once
+#include "k3serializer_queue.h"
+#include <memory>
+
+#if defined(__linux__)
+// Shared-memory channel between local processes: a K3FrameRing placed in a memfd or POSIX
+// shared memory object that every party maps. Producers in any process serialize straight
+// into the mapped ring; the consumer decodes each frame in place from the mapping. An idle
+// consumer, or a producer facing a full ring, spins briefly and then sleeps on a futex in the
+// shared memory, so a message costs no syscall while the other side keeps up.
+//
+// Any number of producers, one consumer. A party that dies mid-frame stalls the channel;
+// pass a timeout to bound the wait.
+class K3IpcChannel
+{
+public:
+	static constexpr uint32_t kMagic = 0x4350334B;  // "K3PC"
+	static constexpr int kSpinIterations = 4096;
+
+	K3IpcChannel() : fd_(-1), mapping_(nullptr), mappingSize_(0), shared_(nullptr) {}
+	~K3IpcChannel() { Close(); }
+	K3IpcChannel(const K3IpcChannel&) = delete;
+	K3IpcChannel& operator=(const K3IpcChannel&) = delete;
+
+	// Creates an anonymous channel in a memfd; capacity is in ring bytes, a power of two.
+	// Children forked afterwards share it, other processes receive fd() over a Unix socket.
+	bool Create(std::size_t capacity);
+	// Creates a channel named by a POSIX shared memory object; fails if it already exists.
+	bool Create(const std::string& name, std::size_t capacity);
+	// Attaches to a channel created by name, or to one whose fd was handed over (the
+	// channel takes ownership of fd).
+	bool Open(const std::string& name);
+	bool Attach(int fd);
+	void Close();
+	static bool Unlink(const std::string& name);
+
+	int fd() const { return fd_; }
+	bool valid() const { return ring_ != nullptr; }
+	std::size_t maxPayload() const { return ring_ ? ring_->maxPayload() : 0; }
+
+	// producer side, any process or thread
+	// timeoutMs < 0 waits for room without limit; a value encoding to more than
+	// maxPayload() bytes fails at once.
+	template<typename T>
+	bool Send(const T& v, int timeoutMs = -1)
+	{
+		K3FrameRing::Reservation reservation;
+		if (!Reserve(K3ByteSize<T>(v), &reservation, timeoutMs))
+		{
+			return false;
+		}
+		K3SpanSink sink(reservation.data, reservation.size);
+		K3Serializer<T>::PutValue(sink, v);
+		Commit(reservation);
+		return true;
+	}
+	bool Reserve(std::size_t size, K3FrameRing::Reservation* reservation, int timeoutMs = -1);
+	void Commit(const K3FrameRing::Reservation& reservation);
+
+	// consumer side, one thread of one process
+	// Appends views of up to maxFrames committed frames, waiting up to timeoutMs for the
+	// first one, and returns how many were added. They stay valid until Release().
+	std::size_t Receive(std::vector<std::string_view>* frames, std::size_t maxFrames = SIZE_MAX, int timeoutMs = -1);
+	// Hands everything received so far back to the producers.
+	void Release();
+	// Receives, decodes and releases a single frame, which must hold exactly one T.
+	template<typename T>
+	bool Receive(T& v, int timeoutMs = -1)
+	{
+		frames_.clear();
+		if (Receive(&frames_, 1, timeoutMs) == 0)
+		{
+			return false;
+		}
+		std::string_view src = frames_[0];
+		const bool ok = K3Serializer<T>::GetValue(src, v) && src.empty();
+		Release();
+		return ok;
+	}
+private:
+	struct Shared;
+
+	bool Map(int fd, std::size_t capacity, bool initialize);
+
+	int fd_;
+	void* mapping_;
+	std::size_t mappingSize_;
+	Shared* shared_;
+	std::unique_ptr<K3FrameRing> ring_;
+	std::vector<iovec> peeked_;
+	std::vector<std::string_view> frames_;
+};
+#endif
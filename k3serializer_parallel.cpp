@@ -0,0 +1,104 @@
+#include "k3serializer_parallel.h"
+
+std::size_t K3ThreadPool::DefaultWorkers()
+{
+	const unsigned hardware = std::thread::hardware_concurrency();
+	return hardware > 1 ? hardware - 1 : 0;
+}
+K3ThreadPool::K3ThreadPool(std::size_t workers)
+	: queued_(0), stop_(false)
+{
+	for (std::size_t i = 0; i < std::max<std::size_t>(workers, 1); ++i) {
+		queues_.push_back(std::make_unique<Queue>());
+	}
+	for (std::size_t i = 0; i < workers; ++i) {
+		workers_.emplace_back(&K3ThreadPool::WorkerLoop, this, i);
+	}
+}
+K3ThreadPool::~K3ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex_);
+		stop_ = true;
+	}
+	sleepCv_.notify_all();
+	for (auto& worker : workers_) {
+		worker.join();
+	}
+}
+void K3ThreadPool::ParallelFor(std::size_t count, const std::function<void(std::size_t)>& fn)
+{
+	if (count == 0) {
+		return;
+	}
+	Job job;
+	job.fn = &fn;
+	job.pending = count;
+	for (std::size_t i = 0; i < count; ++i) {
+		Queue& queue = *queues_[i % queues_.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back({ &job, i });
+	}
+	queued_ += count;
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex_);
+	}
+	sleepCv_.notify_all();
+
+	Task task;
+	while (Steal(queues_.size(), &task)) {
+		Execute(task);
+	}
+	// the job lives on this stack: only leave once the last task released it
+	std::unique_lock<std::mutex> lock(job.mutex);
+	job.done.wait(lock, [&job] { return job.pending == 0; });
+}
+bool K3ThreadPool::Pop(std::size_t queue, Task* task)
+{
+	Queue& q = *queues_[queue];
+	std::lock_guard<std::mutex> lock(q.mutex);
+	if (q.tasks.empty()) {
+		return false;
+	}
+	*task = q.tasks.back();
+	q.tasks.pop_back();
+	--queued_;
+	return true;
+}
+bool K3ThreadPool::Steal(std::size_t thief, Task* task)
+{
+	for (std::size_t i = 1; i <= queues_.size(); ++i) {
+		Queue& q = *queues_[(thief + i) % queues_.size()];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (!q.tasks.empty()) {
+			*task = q.tasks.front();
+			q.tasks.pop_front();
+			--queued_;
+			return true;
+		}
+	}
+	return false;
+}
+void K3ThreadPool::Execute(const Task& task)
+{
+	(*task.job->fn)(task.index);
+	std::lock_guard<std::mutex> lock(task.job->mutex);
+	if (--task.job->pending == 0) {
+		task.job->done.notify_all();
+	}
+}
+void K3ThreadPool::WorkerLoop(std::size_t id)
+{
+	for (;;) {
+		Task task;
+		if (Pop(id, &task) || Steal(id, &task)) {
+			Execute(task);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleepMutex_);
+		sleepCv_.wait(lock, [this] { return stop_ || queued_ > 0; });
+		if (stop_ && queued_ == 0) {
+			return;
+		}
+	}
+}
@@ -0,0 +1,332 @@
+#pragma once
+#include "k3serializer.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Work-stealing pool: every worker pops from the back of its own queue and steals from the
+// front of the others when it runs dry. The thread calling ParallelFor() works too.
+class K3ThreadPool
+{
+public:
+	explicit K3ThreadPool(std::size_t workers = DefaultWorkers());
+	~K3ThreadPool();
+	K3ThreadPool(const K3ThreadPool&) = delete;
+	K3ThreadPool& operator=(const K3ThreadPool&) = delete;
+
+	// Runs fn(0) ... fn(count - 1) and returns once all of them are done.
+	void ParallelFor(std::size_t count, const std::function<void(std::size_t)>& fn);
+	std::size_t concurrency() const { return workers_.size() + 1; }
+
+	static std::size_t DefaultWorkers();
+private:
+	struct Job
+	{
+		const std::function<void(std::size_t)>* fn;
+		std::size_t pending;
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+	struct Task
+	{
+		Job* job;
+		std::size_t index;
+	};
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+	bool Pop(std::size_t queue, Task* task);
+	bool Steal(std::size_t thief, Task* task);
+	void Execute(const Task& task);
+	void WorkerLoop(std::size_t id);
+
+	std::vector<std::unique_ptr<Queue>> queues_;
+	std::vector<std::thread> workers_;
+	std::atomic<std::size_t> queued_;
+	std::mutex sleepMutex_;
+	std::condition_variable sleepCv_;
+	bool stop_;
+};
+
+// Sidecar for a serialized vector: element index and byte offset (from the start of the
+// container, length varint included) of every chunk, closed by the element count and the
+// total size. It is itself serializable, so it can be stored next to the payload.
+struct K3ChunkIndex
+{
+	std::vector<uint64_t> elements;
+	std::vector<uint64_t> offsets;
+	using SuperClass = void;
+	static constexpr inline auto kMetaClassMember = std::make_tuple(&K3ChunkIndex::elements, &K3ChunkIndex::offsets);
+
+	std::size_t chunks() const { return elements.empty() ? 0 : elements.size() - 1; }
+
+	// Builds the index of an already serialized vector by skipping over its elements.
+	template<typename Vector>
+	static bool Build(std::string_view src, std::size_t chunkElements, K3ChunkIndex* index)
+	{
+		static_assert(!std::is_same_v<typename Vector::value_type, bool>, "std::vector<bool> is bit-packed and has no per-element offsets");
+		const std::size_t total = src.size();
+		uint32_t vsize;
+		if (!K3Serializer<uint32_t>::GetValue(src, vsize))
+		{
+			return false;
+		}
+		index->elements.clear();
+		index->offsets.clear();
+		for (uint32_t i = 0; i < vsize; ++i)
+		{
+			if (i % chunkElements == 0)
+			{
+				index->elements.push_back(i);
+				index->offsets.push_back(total - src.size());
+			}
+			if (!K3SkipValue<typename Vector::value_type>(src))
+			{
+				return false;
+			}
+		}
+		index->elements.push_back(vsize);
+		index->offsets.push_back(total - src.size());
+		return true;
+	}
+};
+template<> class K3Serializer<K3ChunkIndex> : public K3SerializerClass<K3ChunkIndex> {};
+
+// Encodes big containers on a K3ThreadPool into exactly the bytes K3Serializer would write.
+// Chunk sizes are measured with K3ByteSize, the output is grown once and every chunk is
+// encoded straight into its final place. Canonical mode is carried over to the workers.
+template<typename T>
+class K3ParallelEncoder;
+
+template<typename T, typename A>
+class K3ParallelEncoder<std::vector<T, A>>
+{
+public:
+	static constexpr std::size_t kDefaultChunkElements = 4096;
+
+	// When index is given it is filled with the chunk layout for K3ParallelDecoder.
+	static void PutValue(std::string& dst, const std::vector<T, A>& v, K3ThreadPool& pool,
+		std::size_t chunkElements = kDefaultChunkElements, K3ChunkIndex* index = nullptr)
+	{
+		const std::size_t start = dst.size();
+		const std::size_t chunks = (v.size() + chunkElements - 1) / chunkElements;
+		if (chunks < 2 || pool.concurrency() < 2)
+		{
+			K3Serializer<std::vector<T, A>>::PutValue(dst, v);
+			if (index)
+			{
+				K3ChunkIndex::Build<std::vector<T, A>>(std::string_view(dst).substr(start), chunkElements, index);
+			}
+			return;
+		}
+		K3Serializer<uint32_t>::PutValue(dst, static_cast<uint32_t>(v.size()));
+		const bool canonical = K3CanonicalScope::IsEnabled();
+		std::vector<std::size_t> offsets(chunks + 1, 0);
+		pool.ParallelFor(chunks, [&](std::size_t c) {
+			K3CanonicalScope scope(canonical);
+			std::size_t size = 0;
+			for (std::size_t i = c * chunkElements, end = std::min(v.size(), i + chunkElements); i < end; ++i)
+			{
+				size += K3ByteSize<T>(v[i]);
+			}
+			offsets[c + 1] = size;
+		});
+		for (std::size_t c = 0; c < chunks; ++c)
+		{
+			offsets[c + 1] += offsets[c];
+		}
+		const std::size_t base = dst.size();
+		dst.resize(base + offsets[chunks]);
+		pool.ParallelFor(chunks, [&](std::size_t c) {
+			K3CanonicalScope scope(canonical);
+			K3SpanSink sink(&dst[base + offsets[c]], offsets[c + 1] - offsets[c]);
+			for (std::size_t i = c * chunkElements, end = std::min(v.size(), i + chunkElements); i < end; ++i)
+			{
+				K3Serializer<T>::PutValue(sink, v[i]);
+			}
+		});
+		if (index)
+		{
+			index->elements.clear();
+			index->offsets.clear();
+			for (std::size_t c = 0; c <= chunks; ++c)
+			{
+				index->elements.push_back(std::min(v.size(), c * chunkElements));
+				index->offsets.push_back(base - start + offsets[c]);
+			}
+		}
+	}
+};
+
+// std::vector<bool> is bit-packed as a whole, there are no element boundaries to split at.
+template<typename A>
+class K3ParallelEncoder<std::vector<bool, A>>
+{
+public:
+	static constexpr std::size_t kDefaultChunkElements = 4096;
+
+	// An index is left empty, which makes K3ParallelDecoder decode sequentially.
+	static void PutValue(std::string& dst, const std::vector<bool, A>& v, K3ThreadPool&,
+		std::size_t = kDefaultChunkElements, K3ChunkIndex* index = nullptr)
+	{
+		K3Serializer<std::vector<bool, A>>::PutValue(dst, v);
+		if (index)
+		{
+			index->elements.clear();
+			index->offsets.clear();
+		}
+	}
+};
+
+// Decodes a vector chunk by chunk on a K3ThreadPool into pre-sized storage, using the
+// K3ChunkIndex written with it. Like K3Serializer, decoded elements are appended to v.
+// An index that does not describe src falls back to the sequential decoder.
+template<typename T>
+class K3ParallelDecoder;
+
+template<typename T, typename A>
+class K3ParallelDecoder<std::vector<T, A>>
+{
+public:
+	static bool GetValue(std::string_view& src, std::vector<T, A>& v, const K3ChunkIndex& index, K3ThreadPool& pool)
+	{
+		std::string_view body = src;
+		uint32_t vsize;
+		if (!K3Serializer<uint32_t>::GetValue(body, vsize))
+		{
+			return false;
+		}
+		if (!Describes(index, vsize, src.size() - body.size(), src.size()))
+		{
+			return K3Serializer<std::vector<T, A>>::GetValue(src, v);
+		}
+		const std::size_t base = v.size();
+		v.resize(base + vsize);
+		std::atomic<bool> ok(true);
+		pool.ParallelFor(index.chunks(), [&](std::size_t c) {
+			std::string_view chunk = src.substr(index.offsets[c], index.offsets[c + 1] - index.offsets[c]);
+			for (uint64_t i = index.elements[c]; i < index.elements[c + 1]; ++i)
+			{
+				if (!K3Serializer<T>::GetValue(chunk, v[base + i]))
+				{
+					ok = false;
+					return;
+				}
+			}
+			if (!chunk.empty())
+			{
+				ok = false;
+			}
+		});
+		if (!ok)
+		{
+			return false;
+		}
+		src.remove_prefix(index.offsets.back());
+		return true;
+	}
+private:
+	static bool Describes(const K3ChunkIndex& index, uint32_t vsize, std::size_t header, std::size_t available)
+	{
+		if (index.elements.size() < 2 || index.elements.size() != index.offsets.size()
+			|| index.elements.front() != 0 || index.elements.back() != vsize
+			|| index.offsets.front() != header || index.offsets.back() > available)
+		{
+			return false;
+		}
+		for (std::size_t c = 1; c < index.elements.size(); ++c)
+		{
+			if (index.elements[c] < index.elements[c - 1] || index.offsets[c] < index.offsets[c - 1])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+// std::vector<bool> elements share bytes, so chunks could not be decoded apart; it is
+// always decoded sequentially.
+template<typename A>
+class K3ParallelDecoder<std::vector<bool, A>>
+{
+public:
+	static bool GetValue(std::string_view& src, std::vector<bool, A>& v, const K3ChunkIndex&, K3ThreadPool&)
+	{
+		return K3Serializer<std::vector<bool, A>>::GetValue(src, v);
+	}
+};
+
+template<typename K, typename V, typename H, typename E, typename A>
+class K3ParallelEncoder<std::unordered_map<K, V, H, E, A>>
+{
+	using Map = std::unordered_map<K, V, H, E, A>;
+public:
+	static constexpr std::size_t kDefaultChunkElements = 4096;
+
+	static void PutValue(std::string& dst, const Map& v, K3ThreadPool& pool,
+		std::size_t chunkElements = kDefaultChunkElements)
+	{
+		const std::size_t chunks = (v.size() + chunkElements - 1) / chunkElements;
+		if (chunks < 2 || pool.concurrency() < 2)
+		{
+			K3Serializer<Map>::PutValue(dst, v);
+			return;
+		}
+		const bool canonical = K3CanonicalScope::IsEnabled();
+		if constexpr (!K3IsLessComparable<K>::value)
+		{
+			if (canonical)
+			{
+				// the sequential serializer orders such keys by their encoded bytes
+				K3Serializer<Map>::PutValue(dst, v);
+				return;
+			}
+		}
+		std::vector<const typename Map::value_type*> entries;
+		entries.reserve(v.size());
+		for (const auto& kv : v)
+		{
+			entries.push_back(&kv);
+		}
+		if constexpr (K3IsLessComparable<K>::value)
+		{
+			if (canonical)
+			{
+				std::sort(entries.begin(), entries.end(), [](const auto* lhs, const auto* rhs) { return lhs->first < rhs->first; });
+			}
+		}
+		K3Serializer<uint32_t>::PutValue(dst, static_cast<uint32_t>(v.size()));
+		std::vector<std::size_t> offsets(chunks + 1, 0);
+		pool.ParallelFor(chunks, [&](std::size_t c) {
+			K3CanonicalScope scope(canonical);
+			std::size_t size = 0;
+			for (std::size_t i = c * chunkElements, end = std::min(entries.size(), i + chunkElements); i < end; ++i)
+			{
+				size += K3ByteSize<K>(entries[i]->first) + K3ByteSize<V>(entries[i]->second);
+			}
+			offsets[c + 1] = size;
+		});
+		for (std::size_t c = 0; c < chunks; ++c)
+		{
+			offsets[c + 1] += offsets[c];
+		}
+		const std::size_t base = dst.size();
+		dst.resize(base + offsets[chunks]);
+		pool.ParallelFor(chunks, [&](std::size_t c) {
+			K3CanonicalScope scope(canonical);
+			K3SpanSink sink(&dst[base + offsets[c]], offsets[c + 1] - offsets[c]);
+			for (std::size_t i = c * chunkElements, end = std::min(entries.size(), i + chunkElements); i < end; ++i)
+			{
+				K3Serializer<K>::PutValue(sink, entries[i]->first);
+				K3Serializer<V>::PutValue(sink, entries[i]->second);
+			}
+		});
+	}
+};
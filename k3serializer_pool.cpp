@@ -0,0 +1,156 @@
+#include "k3serializer_pool.h"
+#include <atomic>
+
+namespace
+{
+	struct GlobalStash
+	{
+		std::atomic<std::string*> slots[K3BufferPool::kClassCount][K3BufferPool::kGlobalSlots] = {};
+		~GlobalStash()
+		{
+			for (auto& slotClass : slots) {
+				for (auto& slot : slotClass) {
+					delete slot.exchange(nullptr);
+				}
+			}
+		}
+	};
+	GlobalStash gStash;
+
+	std::size_t ClassCapacity(std::size_t sizeClass)
+	{
+		return K3BufferPool::kMinCapacity << (2 * sizeClass);
+	}
+	// smallest class holding size bytes
+	std::size_t CeilClass(std::size_t size)
+	{
+		std::size_t sizeClass = 0;
+		while (sizeClass + 1 < K3BufferPool::kClassCount && ClassCapacity(sizeClass) < size) {
+			++sizeClass;
+		}
+		return sizeClass;
+	}
+	// largest class a buffer of this capacity can serve
+	std::size_t FloorClass(std::size_t capacity)
+	{
+		std::size_t sizeClass = 0;
+		while (sizeClass + 1 < K3BufferPool::kClassCount && ClassCapacity(sizeClass + 1) <= capacity) {
+			++sizeClass;
+		}
+		return sizeClass;
+	}
+	bool PushGlobal(std::size_t sizeClass, std::string* str)
+	{
+		for (auto& slot : gStash.slots[sizeClass]) {
+			std::string* expected = nullptr;
+			if (slot.load(std::memory_order_relaxed) == nullptr
+				&& slot.compare_exchange_strong(expected, str, std::memory_order_release, std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+		return false;
+	}
+	std::string* PopGlobal(std::size_t sizeClass)
+	{
+		for (auto& slot : gStash.slots[sizeClass]) {
+			if (slot.load(std::memory_order_relaxed) != nullptr) {
+				std::string* str = slot.exchange(nullptr, std::memory_order_acquire);
+				if (str != nullptr) {
+					return str;
+				}
+			}
+		}
+		return nullptr;
+	}
+	void Discard(std::size_t sizeClass, std::string* str)
+	{
+		if (!PushGlobal(sizeClass, str)) {
+			delete str;
+		}
+	}
+
+	struct LocalPool
+	{
+		std::vector<std::string*> free[K3BufferPool::kClassCount];
+		std::size_t lowWater[K3BufferPool::kClassCount] = {};
+		std::size_t acquired = 0;
+		std::size_t allocations = 0;
+
+		void Trim()
+		{
+			for (std::size_t c = 0; c < K3BufferPool::kClassCount; ++c) {
+				for (std::size_t i = 0; i < lowWater[c]; ++i) {
+					Discard(c, free[c].back());
+					free[c].pop_back();
+				}
+				lowWater[c] = free[c].size();
+			}
+		}
+		~LocalPool()
+		{
+			for (std::size_t c = 0; c < K3BufferPool::kClassCount; ++c) {
+				for (std::string* str : free[c]) {
+					Discard(c, str);
+				}
+			}
+		}
+	};
+	thread_local LocalPool tLocalPool;
+}
+
+K3Buffer K3BufferPool::Acquire(std::size_t sizeHint)
+{
+	LocalPool& pool = tLocalPool;
+	if (++pool.acquired % kTrimPeriod == 0) {
+		pool.Trim();
+	}
+	const std::size_t sizeClass = CeilClass(sizeHint);
+	auto& freeList = pool.free[sizeClass];
+	std::string* str = nullptr;
+	if (!freeList.empty()) {
+		str = freeList.back();
+		freeList.pop_back();
+		pool.lowWater[sizeClass] = std::min(pool.lowWater[sizeClass], freeList.size());
+	}
+	else if ((str = PopGlobal(sizeClass)) == nullptr) {
+		str = new std::string();
+		str->reserve(std::max(sizeHint, ClassCapacity(sizeClass)));
+		++pool.allocations;
+	}
+	// a hint above the largest class is served from that class, which may be too small
+	if (str->capacity() < sizeHint) {
+		str->reserve(sizeHint);
+	}
+	return K3Buffer(str);
+}
+void K3BufferPool::Release(std::string* str)
+{
+	if (str->capacity() > kMaxPooledCapacity || str->capacity() < kMinCapacity) {
+		delete str;
+		return;
+	}
+	str->clear();
+	const std::size_t sizeClass = FloorClass(str->capacity());
+	auto& freeList = tLocalPool.free[sizeClass];
+	if (freeList.size() < kMaxLocalBuffers) {
+		freeList.push_back(str);
+	}
+	else {
+		Discard(sizeClass, str);
+	}
+}
+std::size_t K3BufferPool::LocalAllocations()
+{
+	return tLocalPool.allocations;
+}
+void K3BufferPool::TrimLocal()
+{
+	LocalPool& pool = tLocalPool;
+	for (std::size_t c = 0; c < kClassCount; ++c) {
+		for (std::string* str : pool.free[c]) {
+			delete str;
+		}
+		pool.free[c].clear();
+		pool.lowWater[c] = 0;
+	}
+}
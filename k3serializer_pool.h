@@ -0,0 +1,74 @@
+#pragma once
+#include "k3serializer.h"
+
+class K3Buffer;
+
+// Recycles output strings by capacity class. Released buffers go to a per-thread free list
+// first and, once that is full, to a small lock-free global stash, so a buffer released on
+// another thread is still reused. Buffers idle in a thread's list for a whole trim period
+// (its low-water mark) are handed back, and buffers grown past kMaxPooledCapacity are freed.
+class K3BufferPool
+{
+public:
+	static constexpr std::size_t kClassCount = 6;  // 256 B, 1 KiB, ... 256 KiB
+	static constexpr std::size_t kMinCapacity = 256;
+	static constexpr std::size_t kMaxPooledCapacity = kMinCapacity << (2 * (kClassCount - 1));
+	static constexpr std::size_t kMaxLocalBuffers = 16;
+	static constexpr std::size_t kGlobalSlots = 16;
+	static constexpr std::size_t kTrimPeriod = 4096;
+
+	// A buffer with room for at least sizeHint bytes.
+	static K3Buffer Acquire(std::size_t sizeHint = 0);
+	// Strings allocated by the pool on this thread; flat in steady state.
+	static std::size_t LocalAllocations();
+	// Frees every buffer cached by this thread.
+	static void TrimLocal();
+private:
+	friend class K3Buffer;
+	static void Release(std::string* str);
+};
+
+// Pooled output buffer, itself a sink: K3Serializer<T>::PutValue(buffer, v). It goes back to
+// K3BufferPool when destroyed.
+class K3Buffer
+{
+public:
+	K3Buffer() : str_(nullptr) {}
+	~K3Buffer() { reset(); }
+	K3Buffer(K3Buffer&& other) noexcept : str_(other.str_) { other.str_ = nullptr; }
+	K3Buffer& operator=(K3Buffer&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			str_ = other.str_;
+			other.str_ = nullptr;
+		}
+		return *this;
+	}
+	K3Buffer(const K3Buffer&) = delete;
+	K3Buffer& operator=(const K3Buffer&) = delete;
+
+	void append(const char* p, std::size_t n) { str_->append(p, n); }
+	void push_back(char c) { str_->push_back(c); }
+	std::size_t size() const { return str_->size(); }
+	const char* data() const { return str_->data(); }
+	std::string& str() { return *str_; }
+	const std::string& str() const { return *str_; }
+	std::string_view view() const { return *str_; }
+	explicit operator bool() const { return str_ != nullptr; }
+
+	void reset()
+	{
+		if (str_ != nullptr)
+		{
+			K3BufferPool::Release(str_);
+			str_ = nullptr;
+		}
+	}
+private:
+	friend class K3BufferPool;
+	explicit K3Buffer(std::string* str) : str_(str) {}
+
+	std::string* str_;
+};
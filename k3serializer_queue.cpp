@@ -0,0 +1,108 @@
+#include "k3serializer_queue.h"
+#include <cassert>
+#include <new>
+
+K3FrameRing::K3FrameRing(std::size_t capacity)
+	: memory_(static_cast<char*>(::operator new(MemorySize(capacity), std::align_val_t(64)))), owned_(true), capacity_(capacity)
+{
+	Attach(memory_, true);
+}
+K3FrameRing::K3FrameRing(void* memory, std::size_t capacity, bool initialize)
+	: memory_(static_cast<char*>(memory)), owned_(false), capacity_(capacity)
+{
+	Attach(memory, initialize);
+}
+K3FrameRing::~K3FrameRing()
+{
+	if (owned_) {
+		control_->~Control();
+		::operator delete(memory_, std::align_val_t(64));
+	}
+}
+std::size_t K3FrameRing::MemorySize(std::size_t capacity)
+{
+	return kControlSize + capacity;
+}
+void K3FrameRing::Attach(void* memory, bool initialize)
+{
+	// every position is reduced with & (capacity_ - 1)
+	assert(capacity_ >= kMinCapacity && (capacity_ & (capacity_ - 1)) == 0 && "K3FrameRing capacity must be a power of two");
+	if (initialize) {
+		control_ = new (memory) Control();
+		control_->tail.store(0, std::memory_order_relaxed);
+		control_->head.store(0, std::memory_order_relaxed);
+		memset(static_cast<char*>(memory) + kControlSize, 0, capacity_);
+	}
+	else {
+		control_ = static_cast<Control*>(memory);
+	}
+	data_ = static_cast<char*>(memory) + kControlSize;
+	peeked_ = control_->head.load(std::memory_order_acquire);
+}
+bool K3FrameRing::TryReserve(std::size_t size, Reservation* reservation)
+{
+	if (size > maxPayload() || size > UINT32_MAX) {
+		return false;
+	}
+	const std::size_t frame = FrameSize(size);
+	uint64_t tail = control_->tail.load(std::memory_order_relaxed);
+	uint64_t padding;
+	do {
+		const uint64_t head = control_->head.load(std::memory_order_acquire);
+		const std::size_t offset = tail & (capacity_ - 1);
+		// frames never wrap: the rest of the ring becomes a padding frame instead
+		padding = capacity_ - offset < frame ? capacity_ - offset : 0;
+		if (tail + padding + frame - head > capacity_) {
+			return false;
+		}
+	} while (!control_->tail.compare_exchange_weak(tail, tail + padding + frame, std::memory_order_relaxed));
+	if (padding != 0) {
+		Header(tail).store(kCommitted | kPadding | padding, std::memory_order_release);
+		tail += padding;
+	}
+	reservation->data = data_ + (tail & (capacity_ - 1)) + kFrameHeaderSize;
+	reservation->size = size;
+	reservation->position = tail;
+	return true;
+}
+void K3FrameRing::Commit(const Reservation& reservation)
+{
+	Header(reservation.position).store(kCommitted | reservation.size, std::memory_order_release);
+}
+std::size_t K3FrameRing::Peek(std::vector<iovec>* frames, std::size_t maxFrames)
+{
+	// a full ring wraps onto the unreleased head frame, stop there
+	const uint64_t end = control_->head.load(std::memory_order_relaxed) + capacity_;
+	std::size_t count = 0;
+	while (count < maxFrames && peeked_ < end) {
+		const uint64_t header = Header(peeked_).load(std::memory_order_acquire);
+		if ((header & kCommitted) == 0) {
+			break;
+		}
+		const std::size_t length = static_cast<uint32_t>(header);
+		if (header & kPadding) {
+			peeked_ += length;
+			continue;
+		}
+		frames->push_back({ data_ + (peeked_ & (capacity_ - 1)) + kFrameHeaderSize, length });
+		peeked_ += FrameSize(length);
+		++count;
+	}
+	return count;
+}
+void K3FrameRing::Release()
+{
+	// zero the released bytes: a later header may land anywhere in them and must read as
+	// not committed until its producer says otherwise
+	const uint64_t head = control_->head.load(std::memory_order_relaxed);
+	const std::size_t begin = head & (capacity_ - 1);
+	const std::size_t length = peeked_ - head;
+	const std::size_t first = std::min(length, capacity_ - begin);
+	memset(data_ + begin, 0, first);
+	memset(data_, 0, length - first);
+	control_->head.store(peeked_, std::memory_order_release);
+}
+bool K3FrameRing::empty() const
+{
+	return control_->head.load(std::memory_order_acquire) == control_->tail.load(std::memory_order_acquire);
+}
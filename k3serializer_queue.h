@@ -0,0 +1,97 @@
+#pragma once
+#include "k3serializer.h"
+#include <atomic>
+#include <sys/uio.h>
+
+// Bounded lock-free ring of serialized frames, written by many threads and drained by one.
+// A producer reserves room for a whole frame with a single compare-exchange on the tail,
+// serializes straight into it and commits; the consumer collects committed frames in order
+// as an iovec batch for one writev() and releases them afterwards. A reserved but not yet
+// committed frame holds back the frames reserved after it.
+//
+// The ring can live in caller-provided memory of MemorySize(capacity) bytes (e.g. shared
+// memory); positions are kept in that memory too, so all parties see the same state.
+class K3FrameRing
+{
+public:
+	static constexpr std::size_t kFrameHeaderSize = 8;
+	static constexpr std::size_t kFrameAlign = 8;
+	static constexpr std::size_t kMinCapacity = 64;
+
+	struct Reservation
+	{
+		char* data;
+		std::size_t size;
+		uint64_t position;
+	};
+
+	// capacity: ring bytes, a power of two of at least kMinCapacity; frame headers and
+	// alignment padding count too.
+	explicit K3FrameRing(std::size_t capacity);
+	// Uses memory, initializing it first when `initialize`, or attaching to a ring set up by
+	// another party otherwise.
+	K3FrameRing(void* memory, std::size_t capacity, bool initialize);
+	~K3FrameRing();
+	K3FrameRing(const K3FrameRing&) = delete;
+	K3FrameRing& operator=(const K3FrameRing&) = delete;
+
+	static std::size_t MemorySize(std::size_t capacity);
+	std::size_t capacity() const { return capacity_; }
+	// Largest payload a frame can carry. Frames never wrap, so one has to fit into the rest of
+	// the ring after a padding frame; capping frames at half the ring guarantees that an empty
+	// ring always has room.
+	std::size_t maxPayload() const { return capacity_ / 2 - kFrameHeaderSize; }
+
+	// producer side, thread safe
+	// TryReserve fails while the ring is too full, and always for a size above maxPayload().
+	bool TryReserve(std::size_t size, Reservation* reservation);
+	void Commit(const Reservation& reservation);
+	template<typename T>
+	bool TryPush(const T& v)
+	{
+		Reservation reservation;
+		if (!TryReserve(K3ByteSize<T>(v), &reservation))
+		{
+			return false;
+		}
+		K3SpanSink sink(reservation.data, reservation.size);
+		K3Serializer<T>::PutValue(sink, v);
+		Commit(reservation);
+		return true;
+	}
+
+	// consumer side, one thread only
+	// Appends the payloads of up to maxFrames further committed frames to frames and returns
+	// how many were added. They stay valid until Release().
+	std::size_t Peek(std::vector<iovec>* frames, std::size_t maxFrames = SIZE_MAX);
+	// Hands everything peeked so far back to the producers.
+	void Release();
+	bool empty() const;
+private:
+	struct Control
+	{
+		alignas(64) std::atomic<uint64_t> tail;
+		alignas(64) std::atomic<uint64_t> head;
+	};
+	static constexpr uint64_t kCommitted = uint64_t(1) << 32;
+	static constexpr uint64_t kPadding = uint64_t(1) << 33;
+	static constexpr std::size_t kControlSize = (sizeof(Control) + 63) / 64 * 64;
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "frame headers need lock-free 64-bit atomics");
+
+	static std::size_t FrameSize(std::size_t payload)
+	{
+		return kFrameHeaderSize + (payload + kFrameAlign - 1) / kFrameAlign * kFrameAlign;
+	}
+	std::atomic<uint64_t>& Header(uint64_t position)
+	{
+		return *reinterpret_cast<std::atomic<uint64_t>*>(data_ + (position & (capacity_ - 1)));
+	}
+	void Attach(void* memory, bool initialize);
+
+	char* memory_;
+	bool owned_;
+	Control* control_;
+	char* data_;
+	std::size_t capacity_;
+	uint64_t peeked_;
+};
@@ -0,0 +1,126 @@
+#include "k3serializer_record.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+	bool WriteAll(int fd, const char* p, std::size_t n)
+	{
+		while (n > 0) {
+			const ssize_t written = ::write(fd, p, n);
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return false;
+			}
+			p += written;
+			n -= static_cast<std::size_t>(written);
+		}
+		return true;
+	}
+}
+
+bool K3RecordWriter::Open(const std::string& path)
+{
+	Close();
+	fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	return fd_ >= 0;
+}
+bool K3RecordWriter::Flush()
+{
+	if (!WriteAll(fd_, buffer_.data(), buffer_.size())) {
+		return false;
+	}
+	offset_ += buffer_.size();
+	buffer_.clear();
+	return true;
+}
+bool K3RecordWriter::Close()
+{
+	if (fd_ < 0) {
+		return false;
+	}
+	const uint64_t indexOffset = offset_ + buffer_.size();
+	char buf[8];
+	for (uint64_t offset : offsets_) {
+		EncodeFixed64(buf, offset);
+		buffer_.append(buf, sizeof(buf));
+	}
+	EncodeFixed64(buf, indexOffset);
+	buffer_.append(buf, 8);
+	EncodeFixed64(buf, offsets_.size());
+	buffer_.append(buf, 8);
+	EncodeFixed32(buf, kMagic);
+	buffer_.append(buf, 4);
+	bool result = Flush();
+	result = ::close(fd_) == 0 && result;
+	fd_ = -1;
+	offset_ = 0;
+	buffer_.clear();
+	offsets_.clear();
+	return result;
+}
+
+bool K3RecordReader::Open(const std::string& path)
+{
+	Close();
+	const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < K3RecordWriter::kFooterLength) {
+		::close(fd);
+		return false;
+	}
+	void* data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	data_ = static_cast<const char*>(data);
+	length_ = st.st_size;
+
+	const char* footer = data_ + length_ - K3RecordWriter::kFooterLength;
+	indexOffset_ = DecodeFixed64(footer);
+	count_ = DecodeFixed64(footer + 8);
+	const uint64_t indexLength = length_ - K3RecordWriter::kFooterLength - indexOffset_;
+	if (DecodeFixed32(footer + 16) != K3RecordWriter::kMagic
+		|| indexOffset_ > length_ - K3RecordWriter::kFooterLength || count_ != indexLength / 8 || indexLength % 8 != 0) {
+		Close();
+		return false;
+	}
+	return true;
+}
+void K3RecordReader::Close()
+{
+	if (data_ != nullptr) {
+		::munmap(const_cast<char*>(data_), length_);
+	}
+	data_ = nullptr;
+	length_ = 0;
+	indexOffset_ = 0;
+	count_ = 0;
+}
+bool K3RecordReader::GetRecord(std::size_t n, std::string_view* record) const
+{
+	if (n >= count_) {
+		return false;
+	}
+	const uint64_t offset = DecodeFixed64(data_ + indexOffset_ + n * 8);
+	if (offset >= indexOffset_) {
+		return false;
+	}
+	const char* limit = data_ + indexOffset_;
+	uint32_t len;
+	const char* p = GetVarint32Ptr(data_ + offset, limit, &len);
+	if (p == nullptr || static_cast<std::size_t>(limit - p) < len) {
+		return false;
+	}
+	*record = std::string_view(p, len);
+	return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "k3serializer.h"
+
+// Record file: framed records (varint length + payload) appended one after another, then an
+// index of the frame offsets (fixed64 each) and a footer
+// (fixed64 index offset, fixed64 record count, fixed32 magic).
+class K3RecordWriter : private K3SerializerBase
+{
+public:
+	static constexpr uint32_t kMagic = 0x4652334B;  // "K3RF"
+	static constexpr std::size_t kFooterLength = 8 + 8 + 4;
+	static constexpr std::size_t kFlushThreshold = 64 * 1024;
+
+	K3RecordWriter() : fd_(-1), offset_(0) {}
+	~K3RecordWriter() { Close(); }
+	K3RecordWriter(const K3RecordWriter&) = delete;
+	K3RecordWriter& operator=(const K3RecordWriter&) = delete;
+
+	// Creates or truncates the file.
+	bool Open(const std::string& path);
+	template<typename T>
+	bool Append(const T& record)
+	{
+		if (fd_ < 0)
+		{
+			return false;
+		}
+		scratch_.clear();
+		K3Serializer<T>::PutValue(scratch_, record);
+		offsets_.push_back(offset_ + buffer_.size());
+		K3Serializer<uint32_t>::PutValue(buffer_, static_cast<uint32_t>(scratch_.size()));
+		buffer_.append(scratch_);
+		return buffer_.size() < kFlushThreshold || Flush();
+	}
+	// Writes the index and the footer. The file is unusable until closed.
+	bool Close();
+private:
+	bool Flush();
+
+	int fd_;
+	uint64_t offset_;
+	std::string buffer_;
+	std::string scratch_;
+	std::vector<uint64_t> offsets_;
+};
+
+// Maps a record file read-only; any record decodes directly from the mapping in O(1).
+class K3RecordReader : private K3SerializerBase
+{
+public:
+	K3RecordReader() : data_(nullptr), length_(0), indexOffset_(0), count_(0) {}
+	~K3RecordReader() { Close(); }
+	K3RecordReader(const K3RecordReader&) = delete;
+	K3RecordReader& operator=(const K3RecordReader&) = delete;
+
+	bool Open(const std::string& path);
+	void Close();
+
+	std::size_t size() const { return count_; }
+	// View of the n-th record payload inside the mapping, valid until Close().
+	bool GetRecord(std::size_t n, std::string_view* record) const;
+	template<typename T>
+	bool GetValue(std::size_t n, T& record) const
+	{
+		std::string_view input;
+		return GetRecord(n, &input) && K3Serializer<T>::GetValue(input, record);
+	}
+private:
+	const char* data_;
+	std::size_t length_;
+	uint64_t indexOffset_;
+	uint64_t count_;
+};
@@ -0,0 +1,64 @@
+#include "k3serializer_report.h"
+#include <cstdio>
+
+K3SizeReport::Member& K3SizeReport::Stats(const std::type_info& type, int member, const std::type_info& memberType)
+{
+	auto it = slots_.find({ std::type_index(type), member });
+	if (it == slots_.end()) {
+		Slot slot = { &type, member, &memberType, Member() };
+		slot.stats.member = member;
+		it = slots_.emplace(std::make_pair(std::type_index(type), member), slot).first;
+	}
+	return it->second.stats;
+}
+std::vector<K3SizeReport::Member> K3SizeReport::Members() const
+{
+	std::vector<Member> members;
+	members.reserve(slots_.size());
+	for (const auto& kv : slots_) {
+		Member m = kv.second.stats;
+		m.type = K3TypeName(*kv.second.type);
+		m.memberType = K3TypeName(*kv.second.memberType);
+		members.push_back(std::move(m));
+	}
+	std::stable_sort(members.begin(), members.end(), [](const Member& lhs, const Member& rhs) { return lhs.bytes > rhs.bytes; });
+	return members;
+}
+std::string K3SizeReport::ToString() const
+{
+	std::string out;
+	char line[256];
+	snprintf(line, sizeof(line), "%llu objects, %llu bytes\n", static_cast<unsigned long long>(objects_), static_cast<unsigned long long>(totalBytes_));
+	out += line;
+	for (const Member& m : Members()) {
+		const double share = totalBytes_ == 0 ? 0.0 : 100.0 * m.bytes / totalBytes_;
+		snprintf(line, sizeof(line), "%s[%d] %s: %llu values, %llu bytes (%.1f%%)", m.type.c_str(), m.member, m.memberType.c_str(),
+			static_cast<unsigned long long>(m.count), static_cast<unsigned long long>(m.bytes), share);
+		out += line;
+		if (m.alternatives & kFixed) {
+			out += ", varint lengths";
+			for (std::size_t n = 1; n < m.varintLengths.size(); ++n) {
+				if (m.varintLengths[n] != 0) {
+					snprintf(line, sizeof(line), " %zu:%llu", n, static_cast<unsigned long long>(m.varintLengths[n]));
+					out += line;
+				}
+			}
+		}
+		const std::pair<uint32_t, const char*> alternatives[] = { { kZigzag, "zigzag" }, { kFixed, "fixed" }, { kPacked, "packed" } };
+		const uint64_t sizes[] = { m.zigzagBytes, m.fixedBytes, m.packedBytes };
+		for (std::size_t i = 0; i < 3; ++i) {
+			if ((m.alternatives & alternatives[i].first) && sizes[i] < m.bytes) {
+				snprintf(line, sizeof(line), ", %s saves %llu", alternatives[i].second, static_cast<unsigned long long>(m.bytes - sizes[i]));
+				out += line;
+			}
+		}
+		out += '\n';
+	}
+	return out;
+}
+void K3SizeReport::clear()
+{
+	slots_.clear();
+	objects_ = 0;
+	totalBytes_ = 0;
+}
@@ -0,0 +1,171 @@
+#pragma once
+#include "k3serializer.h"
+#include <map>
+#include <typeindex>
+
+template<typename T, typename = void>
+struct K3IsReflected : std::false_type {};
+template<typename T>
+struct K3IsReflected<T, std::void_t<decltype(T::kMetaClassMember)>> : std::true_type {};
+
+// Where the bytes go. Add() walks reflected objects recursively (super classes, members, and
+// the reflected classes held in vectors, optionals and map values) and accumulates for every
+// member of every class its encoded bytes, the distribution of its varint lengths and what it
+// would take as a zigzag varint, a fixed-width field or, for integer vectors, a K3PackedVector.
+// Nested objects are counted both in the member holding them and in their own members.
+class K3SizeReport
+{
+public:
+	enum Alternative : uint32_t
+	{
+		kZigzag = 1 << 0,  // signed varints
+		kFixed = 1 << 1,   // varint integers and enums
+		kPacked = 1 << 2,  // vectors of integers
+	};
+	struct Member
+	{
+		std::string type;
+		int member;                      // index in the kMetaClassMember of type
+		std::string memberType;
+		uint64_t count;                  // values seen
+		uint64_t bytes;                  // as encoded now
+		std::array<uint64_t, 11> varintLengths;  // [n]: values encoded on n bytes
+		uint32_t alternatives;           // which of the sizes below apply
+		uint64_t zigzagBytes;
+		uint64_t fixedBytes;
+		uint64_t packedBytes;
+	};
+
+	K3SizeReport() : objects_(0), totalBytes_(0) {}
+
+	template<typename T>
+	void Add(const T& obj)
+	{
+		static_assert(K3IsReflected<T>::value, "K3SizeReport walks reflected classes");
+		AddObject(obj);
+		++objects_;
+		totalBytes_ += K3ByteSize<T>(obj);
+	}
+	// Decodes one T from src and adds it.
+	template<typename T>
+	bool AddEncoded(std::string_view& src)
+	{
+		T obj;
+		if (!K3Serializer<T>::GetValue(src, obj))
+		{
+			return false;
+		}
+		Add(obj);
+		return true;
+	}
+
+	uint64_t objects() const { return objects_; }
+	uint64_t totalBytes() const { return totalBytes_; }
+	// Members by decreasing byte count.
+	std::vector<Member> Members() const;
+	// One line per member with its share of the top-level bytes and the cheaper alternatives.
+	std::string ToString() const;
+	void clear();
+private:
+	struct Slot
+	{
+		const std::type_info* type;
+		int member;
+		const std::type_info* memberType;
+		Member stats;
+	};
+	template<typename> struct IsIntegerVector : std::false_type {};
+	template<typename E, typename A>
+	struct IsIntegerVector<std::vector<E, A>> : std::bool_constant<std::is_integral_v<E> && !std::is_same_v<E, bool>> {};
+
+	Member& Stats(const std::type_info& type, int member, const std::type_info& memberType);
+
+	template<typename T>
+	void AddObject(const T& obj)
+	{
+		if constexpr (!std::is_same_v<typename T::SuperClass, void>)
+		{
+			AddObject<typename T::SuperClass>(obj);
+		}
+		AddMembers(obj, std::make_index_sequence<std::tuple_size_v<std::remove_const_t<decltype(T::kMetaClassMember)>>>{});
+	}
+	template<typename T, std::size_t... Idx>
+	void AddMembers(const T& obj, std::index_sequence<Idx...>)
+	{
+		(AddMember<T, Idx>(obj), ...);
+	}
+	template<typename T, std::size_t Idx>
+	void AddMember(const T& obj)
+	{
+		using M = typename K3MemberPointer<std::tuple_element_t<Idx, std::remove_const_t<decltype(T::kMetaClassMember)>>>::MemberType;
+		const M& value = obj.*std::get<Idx>(T::kMetaClassMember);
+		Member& m = Stats(typeid(T), static_cast<int>(Idx), typeid(M));
+		const std::size_t size = K3SerializerClass<T>::template MemberSizeAt<Idx>(obj);
+		++m.count;
+		m.bytes += size;
+		if constexpr (K3IsVarint<M>::value)
+		{
+			++m.varintLengths[std::min<std::size_t>(size, m.varintLengths.size() - 1)];
+			m.alternatives |= kFixed;
+			m.fixedBytes += sizeof(M);
+			using Signed = std::conditional_t<std::is_enum_v<M>, std::underlying_type<M>, std::common_type<M>>;
+			if constexpr (std::is_signed_v<typename Signed::type>)
+			{
+				const int64_t s = static_cast<int64_t>(value);
+				m.alternatives |= kZigzag;
+				m.zigzagBytes += K3SerializerBase::VarintLength((static_cast<uint64_t>(s) << 1) ^ static_cast<uint64_t>(s >> 63));
+			}
+		}
+		else if constexpr (IsIntegerVector<M>::value)
+		{
+			using E = typename M::value_type;
+			K3SizeCounter counter;
+			K3Serializer<K3PackedVector<E>>::PutValue(counter, K3PackedVector<E>(value.begin(), value.end()));
+			m.alternatives |= kPacked;
+			m.packedBytes += counter.size();
+		}
+		AddNested(value);
+	}
+	template<typename M>
+	void AddNested(const M& value)
+	{
+		if constexpr (K3IsReflected<M>::value)
+		{
+			AddObject(value);
+		}
+	}
+	template<typename E, typename A>
+	void AddNested(const std::vector<E, A>& value)
+	{
+		if constexpr (K3IsReflected<E>::value)
+		{
+			for (const auto& e : value)
+			{
+				AddObject(e);
+			}
+		}
+	}
+	template<typename E>
+	void AddNested(const std::optional<E>& value)
+	{
+		if (value)
+		{
+			AddNested(*value);
+		}
+	}
+	template<typename K, typename V, typename H, typename E, typename A>
+	void AddNested(const std::unordered_map<K, V, H, E, A>& value)
+	{
+		if constexpr (K3IsReflected<V>::value)
+		{
+			for (const auto& kv : value)
+			{
+				AddObject(kv.second);
+			}
+		}
+	}
+
+	std::map<std::pair<std::type_index, int>, Slot> slots_;
+	uint64_t objects_;
+	uint64_t totalBytes_;
+};
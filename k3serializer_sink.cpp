@@ -0,0 +1,131 @@
+#include "k3serializer_sink.h"
+
+namespace
+{
+	struct BlockFreeList
+	{
+		std::vector<char*> blocks;
+		~BlockFreeList()
+		{
+			for (char* block : blocks) {
+				delete[] block;
+			}
+		}
+	};
+	thread_local BlockFreeList tBlockFreeList;
+}
+
+void K3IovecSink::AppendPayload(const char* p, std::size_t n)
+{
+	if (n < referenceThreshold_) {
+		append(p, n);
+		return;
+	}
+	segments_.push_back({ p, 0, n });
+	size_ += n;
+}
+const std::vector<iovec>& K3IovecSink::iov()
+{
+	iov_.clear();
+	iov_.reserve(segments_.size());
+	for (const auto& segment : segments_) {
+		const char* base = segment.ref != nullptr ? segment.ref : buffer_.data() + segment.offset;
+		iov_.push_back({ const_cast<char*>(base), segment.len });
+	}
+	return iov_;
+}
+void K3IovecSink::clear()
+{
+	buffer_.clear();
+	segments_.clear();
+	iov_.clear();
+	size_ = 0;
+}
+
+char* K3BlockPool::Allocate()
+{
+	auto& freeList = tBlockFreeList.blocks;
+	if (freeList.empty()) {
+		return new char[kBlockSize];
+	}
+	char* block = freeList.back();
+	freeList.pop_back();
+	return block;
+}
+void K3BlockPool::Release(char* block)
+{
+	auto& freeList = tBlockFreeList.blocks;
+	if (freeList.size() < kMaxCachedBlocks) {
+		freeList.push_back(block);
+	}
+	else {
+		delete[] block;
+	}
+}
+
+void K3ChainBuffer::AppendSlow(const char* p, std::size_t n)
+{
+	while (n > 0) {
+		if (cur_ == end_) {
+			NewBlock();
+		}
+		const std::size_t len = std::min<std::size_t>(n, end_ - cur_);
+		memcpy(cur_, p, len);
+		cur_ += len;
+		p += len;
+		n -= len;
+	}
+}
+void K3ChainBuffer::NewBlock()
+{
+	blocks_.push_back(K3BlockPool::Allocate());
+	cur_ = blocks_.back();
+	end_ = cur_ + K3BlockPool::kBlockSize;
+}
+void K3ChainBuffer::clear()
+{
+	for (char* block : blocks_) {
+		K3BlockPool::Release(block);
+	}
+	blocks_.clear();
+	cur_ = end_ = nullptr;
+}
+
+void K3ChainReader::Advance(std::size_t consumed)
+{
+	position_ += consumed;
+	if (!inScratch_) {
+		window_.remove_prefix(consumed);
+		return;
+	}
+	// back to the blocks right after the straddling value
+	inScratch_ = false;
+	window_ = position_ < chain_.size()
+		? chain_.Block(position_ / K3BlockPool::kBlockSize).substr(position_ % K3BlockPool::kBlockSize)
+		: std::string_view();
+}
+bool K3ChainReader::Grow()
+{
+	std::size_t end = position_ + window_.size();
+	if (end >= chain_.size()) {
+		return false;
+	}
+	if (window_.empty()) {
+		window_ = chain_.Block(end / K3BlockPool::kBlockSize).substr(end % K3BlockPool::kBlockSize);
+		return true;
+	}
+	if (!inScratch_) {
+		scratch_.assign(window_.data(), window_.size());
+		inScratch_ = true;
+	}
+	// at least double the copy, so a value spanning many blocks is retried O(log n) times only
+	const std::size_t target = scratch_.size() + std::max(scratch_.size(), kMinStraddleCopy);
+	while (scratch_.size() < target && end < chain_.size()) {
+		const std::string_view block = chain_.Block(end / K3BlockPool::kBlockSize).substr(end % K3BlockPool::kBlockSize);
+		const std::size_t n = std::min(block.size(), target - scratch_.size());
+		scratch_.append(block.data(), n);
+		end += n;
+	}
+	window_ = scratch_;
+	return true;
+}
@@ -0,0 +1,164 @@
+#pragma once
+#include "k3serializer.h"
+#include <sys/uio.h>
+
+// Scatter-gather output for writev()/sendmsg(). Encoded headers and small values are copied
+// into an internal buffer, while payloads of at least `referenceThreshold` bytes (strings,
+// byte arrays) are referenced in place. The serialized objects must therefore outlive the
+// use of iov().
+class K3IovecSink
+{
+public:
+	static constexpr std::size_t kDefaultReferenceThreshold = 512;
+
+	explicit K3IovecSink(std::size_t referenceThreshold = kDefaultReferenceThreshold)
+		: size_(0), referenceThreshold_(referenceThreshold) {}
+
+	void append(const char* p, std::size_t n)
+	{
+		buffer_.append(p, n);
+		Extend(n);
+	}
+	void push_back(char c)
+	{
+		buffer_.push_back(c);
+		Extend(1);
+	}
+	void AppendPayload(const char* p, std::size_t n);
+
+	std::size_t size() const { return size_; }
+	// The iovec array is rebuilt on every call, the internal buffer may have moved since.
+	// Mind IOV_MAX when passing it to writev().
+	const std::vector<iovec>& iov();
+	void clear();
+private:
+	struct Segment
+	{
+		const char* ref;  // nullptr: [offset, offset + len) of buffer_
+		std::size_t offset;
+		std::size_t len;
+	};
+	void Extend(std::size_t n)
+	{
+		if (segments_.empty() || segments_.back().ref != nullptr)
+		{
+			segments_.push_back({ nullptr, buffer_.size() - n, n });
+		}
+		else
+		{
+			segments_.back().len += n;
+		}
+		size_ += n;
+	}
+
+	std::string buffer_;
+	std::vector<Segment> segments_;
+	std::vector<iovec> iov_;
+	std::size_t size_;
+	std::size_t referenceThreshold_;
+};
+
+// Fixed-size blocks recycled through a per-thread free list.
+class K3BlockPool
+{
+public:
+	static constexpr std::size_t kBlockSize = 64 * 1024;
+	static constexpr std::size_t kMaxCachedBlocks = 64;
+
+	static char* Allocate();
+	static void Release(char* block);
+};
+
+// Output made of a chain of pooled K3BlockPool blocks: growing never moves what was already
+// written, unlike a std::string that doubles and copies. Every block but the last is full.
+class K3ChainBuffer
+{
+public:
+	K3ChainBuffer() : cur_(nullptr), end_(nullptr) {}
+	~K3ChainBuffer() { clear(); }
+	K3ChainBuffer(const K3ChainBuffer&) = delete;
+	K3ChainBuffer& operator=(const K3ChainBuffer&) = delete;
+
+	void append(const char* p, std::size_t n)
+	{
+		if (n <= static_cast<std::size_t>(end_ - cur_))
+		{
+			memcpy(cur_, p, n);
+			cur_ += n;
+			return;
+		}
+		AppendSlow(p, n);
+	}
+	void push_back(char c)
+	{
+		if (cur_ == end_)
+		{
+			NewBlock();
+		}
+		*(cur_++) = c;
+	}
+	// room left in the last block only, a claim never starts a new one
+	char* Claim(std::size_t n) { return n <= static_cast<std::size_t>(end_ - cur_) ? cur_ : nullptr; }
+	void Advance(std::size_t n) { cur_ += n; }
+
+	std::size_t size() const
+	{
+		return blocks_.empty() ? 0 : (blocks_.size() - 1) * K3BlockPool::kBlockSize + (cur_ - blocks_.back());
+	}
+	std::size_t BlockCount() const { return blocks_.size(); }
+	std::string_view Block(std::size_t i) const
+	{
+		return std::string_view(blocks_[i], i + 1 == blocks_.size() ? cur_ - blocks_[i] : K3BlockPool::kBlockSize);
+	}
+	void clear();
+private:
+	void AppendSlow(const char* p, std::size_t n);
+	void NewBlock();
+
+	std::vector<char*> blocks_;
+	char* cur_;
+	char* end_;
+};
+
+// Decodes values from a K3ChainBuffer. Values are decoded in place from the blocks; for one
+// that straddles a block boundary, only the unread bytes of its block and as much of the
+// following ones as it turns out to need are copied to scratch, and decoding returns to the
+// blocks right after it.
+class K3ChainReader
+{
+public:
+	static constexpr std::size_t kMinStraddleCopy = 256;
+
+	explicit K3ChainReader(const K3ChainBuffer& chain) : chain_(chain), position_(0), inScratch_(false) {}
+
+	template<typename T>
+	bool GetValue(T& v)
+	{
+		for (;;)
+		{
+			std::string_view input = window_;
+			if (K3Serializer<T>::GetValue(input, v))
+			{
+				Advance(window_.size() - input.size());
+				return true;
+			}
+			if (!Grow())
+			{
+				return false;
+			}
+			// drop what the failed attempt decoded before retrying on a larger window
+			v = T();
+		}
+	}
+	bool empty() const { return position_ >= chain_.size(); }
+private:
+	void Advance(std::size_t consumed);
+	bool Grow();
+
+	const K3ChainBuffer& chain_;
+	// chain offset of window_.front()
+	std::size_t position_;
+	bool inScratch_;
+	std::string_view window_;
+	std::string scratch_;
+};
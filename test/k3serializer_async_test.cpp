@@ -0,0 +1,220 @@
+#include "../k3serializer.h"
+#include "../k3serializer_async.h"
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+class Reading
+{
+public:
+	std::string sensor;
+	std::vector<int32_t> samples;
+
+	friend bool operator==(const Reading& lhs, const Reading& rhs)
+	{
+		return lhs.sensor == rhs.sensor && lhs.samples == rhs.samples;
+	}
+public:
+	static constexpr inline auto kMetaClassMember = std::make_tuple(&Reading::sensor, &Reading::samples);
+	using SuperClass = void;
+};
+template<>
+class K3Serializer<Reading> : public K3SerializerClass<Reading> {};
+
+// the same members behind a length prefix
+class FramedReading : public Reading
+{
+public:
+	static constexpr inline auto kMetaClassMember = std::make_tuple(&Reading::sensor, &Reading::samples);
+	static constexpr inline uint32_t kMetaClassPolicy = K3ClassPolicy::kLengthPrefixed;
+	using SuperClass = void;
+};
+template<>
+class K3Serializer<FramedReading> : public K3SerializerClass<FramedReading> {};
+
+template<typename T>
+static K3Task CollectOne(K3AsyncReader& reader, std::optional<T>& out)
+{
+	out = co_await reader.get<T>();
+}
+
+static K3Task CollectReadings(K3AsyncReader& reader, std::vector<Reading>& out, bool& finished)
+{
+	while (std::optional<Reading> reading = co_await reader.get<Reading>())
+	{
+		out.push_back(std::move(*reading));
+	}
+	finished = true;
+}
+
+static void MakeSocketPair(int fds[2])
+{
+	REQUIRE((socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0));
+	REQUIRE((fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK) == 0));
+}
+
+TEST_CASE( "testing coroutine reader over a socketpair", "[async]" ) {
+	int fds[2];
+	MakeSocketPair(fds);
+
+	std::vector<Reading> sent;
+	std::string wire;
+	for (int i = 0; i < 20; ++i)
+	{
+		Reading r;
+		r.sensor = "sensor-" + std::to_string(i);
+		for (int j = 0; j < i * 50; ++j)
+		{
+			r.samples.push_back(j * (i % 2 ? -7 : 13));
+		}
+		K3Serializer<Reading>::PutValue(wire, r);
+		sent.push_back(std::move(r));
+	}
+
+	K3AsyncReader reader;
+	std::vector<Reading> received;
+	bool finished = false;
+	K3Task session = CollectReadings(reader, received, finished);
+	REQUIRE((reader.waiting()));
+
+	// drip the stream through the socket in uneven pieces, as an event loop would see it
+	bool sawPartial = false;
+	for (std::size_t pos = 0; pos < wire.size();)
+	{
+		std::size_t n = std::min<std::size_t>(37 + pos % 101, wire.size() - pos);
+		REQUIRE((write(fds[0], wire.data() + pos, n) == static_cast<ssize_t>(n)));
+		pos += n;
+		REQUIRE((reader.FeedFrom(fds[1])));
+		sawPartial = sawPartial || reader.buffered() > 0;
+	}
+	REQUIRE((sawPartial));
+	REQUIRE((received.size() == sent.size()));
+	REQUIRE((received == sent));
+	REQUIRE((reader.buffered() == 0));
+	REQUIRE((finished == false));
+
+	close(fds[0]);
+	REQUIRE((reader.FeedFrom(fds[1]) == false));
+	REQUIRE((finished));
+	REQUIRE((session.done()));
+	REQUIRE((reader.failed() == false));
+	close(fds[1]);
+}
+
+TEST_CASE( "testing coroutine reader with a large message", "[async]" ) {
+	Reading big;
+	big.sensor.assign(1 << 20, 'x');
+	big.samples.assign(100000, -1);
+	std::string wire;
+	K3Serializer<Reading>::PutValue(wire, big);
+
+	K3AsyncReader reader;
+	std::vector<Reading> received;
+	bool finished = false;
+	K3Task session = CollectReadings(reader, received, finished);
+	for (std::size_t pos = 0; pos < wire.size(); pos += 4096)
+	{
+		REQUIRE((received.empty()));
+		reader.Feed(wire.data() + pos, std::min<std::size_t>(4096, wire.size() - pos));
+	}
+	REQUIRE((received.size() == 1));
+	REQUIRE((received[0] == big));
+	REQUIRE((reader.waiting()));
+}
+
+TEST_CASE( "testing coroutine reader probe count", "[async]" ) {
+	FramedReading big;
+	big.sensor = "big";
+	big.samples.assign(1000000, -123456);
+	std::string wire;
+	K3Serializer<Reading>::PutValue(wire, big);
+	const std::size_t kPiece = 64 * 1024;
+	const std::size_t pieces = (wire.size() + kPiece - 1) / kPiece;
+	REQUIRE((pieces > 50));
+
+	// each probe walks the partial value, they must not grow with the number of pieces
+	K3AsyncReader reader;
+	std::optional<Reading> reading;
+	K3Task session = CollectOne(reader, reading);
+	for (std::size_t pos = 0; pos < wire.size(); pos += kPiece)
+	{
+		const std::size_t n = std::min(kPiece, wire.size() - pos);
+		reader.Feed(wire.data() + pos, n, pos + n < wire.size());
+	}
+	REQUIRE((session.done() && reading && *reading == big));
+	// one per doubling of the buffered bytes, plus the final one
+	REQUIRE((reader.probes() <= std::size_t(64 - __builtin_clzll(pieces)) + 2));
+
+	// a length-prefixed value is probed once, when the bytes its prefix announces are in
+	wire.clear();
+	K3Serializer<FramedReading>::PutValue(wire, big);
+	K3AsyncReader framedReader;
+	std::optional<FramedReading> framed;
+	K3Task framedSession = CollectOne(framedReader, framed);
+	for (std::size_t pos = 0; pos < wire.size(); pos += kPiece)
+	{
+		framedReader.Feed(wire.data() + pos, std::min(kPiece, wire.size() - pos));
+	}
+	REQUIRE((framedSession.done() && framed && *framed == big));
+	REQUIRE((framedReader.probes() == 1));
+}
+
+TEST_CASE( "testing coroutine reader at end of input", "[async]" ) {
+	std::string wire;
+	Reading r;
+	r.sensor = "truncated";
+	r.samples = {1, 2, 3};
+	K3Serializer<Reading>::PutValue(wire, r);
+
+	SECTION("stream ends inside a value") {
+		K3AsyncReader reader;
+		std::vector<Reading> received;
+		bool finished = false;
+		K3Task session = CollectReadings(reader, received, finished);
+		reader.Feed(wire.data(), wire.size() - 1);
+		REQUIRE((reader.waiting()));
+		reader.Close();
+		REQUIRE((finished));
+		REQUIRE((received.empty()));
+		REQUIRE((reader.failed()));
+	}
+	SECTION("partial value longer than maxMessage") {
+		K3AsyncReader reader(8);
+		std::vector<Reading> received;
+		bool finished = false;
+		K3Task session = CollectReadings(reader, received, finished);
+		reader.Feed(wire.data(), 4);
+		REQUIRE((finished == false));
+		reader.Feed(wire.data() + 4, 6);
+		REQUIRE((finished));
+		REQUIRE((reader.failed()));
+	}
+	SECTION("destroying a suspended session") {
+		K3AsyncReader reader;
+		std::vector<Reading> received;
+		bool finished = false;
+		{
+			K3Task session = CollectReadings(reader, received, finished);
+			reader.Feed(wire.data(), 3);
+			REQUIRE((session.done() == false && reader.waiting()));
+		}
+		REQUIRE((reader.waiting() == false));
+		reader.Feed(wire.data() + 3, wire.size() - 3);
+		reader.Close();
+		REQUIRE((finished == false && received.empty()));
+
+		// a new session picks up where the destroyed one left off
+		K3AsyncReader next;
+		K3Task session = CollectReadings(next, received, finished);
+		{
+			K3Task abandoned = std::move(session);
+		}
+		next.Feed(wire.data(), wire.size());
+		REQUIRE((received.empty() && next.buffered() == wire.size()));
+		K3Task resumed = CollectReadings(next, received, finished);
+		REQUIRE((received.size() == 1 && received[0] == r));
+	}
+}
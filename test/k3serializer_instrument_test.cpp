@@ -0,0 +1,90 @@
+#include "../k3serializer.h"
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <algorithm>
+
+enum class ECountry
+{
+	US,
+	China,
+	Japan,
+};
+template<>
+class K3Serializer<ECountry> : public K3SerializerEnum<ECountry> {};
+
+class Actor
+{
+public:
+	ECountry country;
+
+public:
+	static constexpr inline auto kMetaClassMember = std::make_tuple(&Actor::country);
+	using SuperClass = void;
+};
+template<>
+class K3Serializer<Actor> : public K3SerializerClass<Actor> {};
+
+class Person : public Actor
+{
+public:
+	std::string name;
+	int age;
+	bool online;
+	bool muted;
+
+public:
+	static constexpr inline auto kMetaClassMember = std::make_tuple(&Person::name, &Person::age, &Person::online, &Person::muted);
+	using SuperClass = Actor;
+};
+template<>
+class K3Serializer<Person> : public K3SerializerClass<Person> {};
+
+TEST_CASE( "testing instrumentation", "[K3Instrument]" ) {
+	Person p;
+	p.country = ECountry::China;
+	p.name = "counted";
+	p.age = 21;
+	p.online = true;
+	p.muted = false;
+	K3Instrument::Reset();
+	std::string str;
+	for (int i = 0; i < 3; ++i)
+	{
+		K3Serializer<Person>::PutValue(str, p);
+	}
+	std::string_view src = str;
+	Person q;
+	REQUIRE((K3Serializer<Person>::GetValue(src, q)));
+	REQUIRE((K3Serializer<Person>::GetValue(src, q)));
+
+	const auto entries = K3Instrument::Snapshot();
+	auto find = [&entries](const std::string& type, int member) {
+		auto it = std::find_if(entries.begin(), entries.end(), [&](const K3InstrumentEntry& e) { return e.type == type && e.member == member; });
+		return it == entries.end() ? nullptr : &*it;
+	};
+	const K3InstrumentEntry* person = find("Person", -1);
+	REQUIRE((person != nullptr));
+	REQUIRE((person->putCalls == 3));
+	REQUIRE((person->putBytes == str.size()));
+	REQUIRE((person->getCalls == 2));
+	REQUIRE((person->getBytes == str.size() / 3 * 2));
+	REQUIRE((person->putCycles > 0));
+	// members are reported under the class declaring them
+	const K3InstrumentEntry* name = find("Person", 0);
+	REQUIRE((name != nullptr));
+	REQUIRE((name->memberType.find("basic_string") != std::string::npos));
+	REQUIRE((name->putBytes == 3 * (p.name.size() + 1)));
+	const K3InstrumentEntry* country = find("Actor", 0);
+	REQUIRE((country != nullptr));
+	REQUIRE((country->getCalls == 2));
+	const K3InstrumentEntry* actor = find("Actor", -1);
+	REQUIRE((actor == nullptr || actor->putCalls == 0));
+	// the byte both bools are packed into is counted under the first one
+	const K3InstrumentEntry* online = find("Person", 2);
+	REQUIRE((online != nullptr));
+	REQUIRE((online->putCalls == 3 && online->putBytes == 3));
+	REQUIRE((online->getCalls == 2 && online->getBytes == 2));
+	REQUIRE((find("Person", 3) == nullptr));
+}